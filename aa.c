@@ -0,0 +1,159 @@
+/*====================== aa.c ========================
+Supersampled anti-aliasing.
+
+With -a N every pixel gets N samples. Rather than one big
+screen at N times the resolution, there are N screen sized
+sample planes, and plane k holds sample k of every pixel.
+Drawing into plane k is drawing the same geometry moved by
+minus the sample's offset, so the rasterizers, the screen
+and zbuffer types and everything that clips to XRES x YRES
+work unchanged. The draw functions loop over the planes
+themselves, so transforming, lighting and setup happen once
+per object and only the raster work is repeated.
+
+The offsets are the standard rotated grid patterns, which
+catch near horizontal and near vertical edges better than
+an ordered grid with the same number of samples.
+
+aa_resolve box filters the planes into the screen. Colors
+are bytes, so the planes are widened to 16 bits, summed 16
+channels at a time with SSE2, divided by N with a shift and
+packed back to bytes.
+==================================================*/
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <emmintrin.h>
+#endif
+
+#include "ml6.h"
+#include "matrix.h"
+#include "display.h"
+#include "config.h"
+#include "aa.h"
+
+// Sample offsets in sixteenths of a pixel, by sample count
+static const int pattern2[2][2] = {{4, 4}, {-4, -4}};
+static const int pattern4[4][2] = {{-2, -6}, {6, -2}, {-6, 2}, {2, 6}};
+static const int pattern8[8][2] = {{1, -3}, {-1, 3}, {5, 1}, {-3, -5},
+                                   {-5, 5}, {-7, -1}, {3, 7}, {7, -7}};
+
+static screen * planes = NULL;
+static zbuffer * depths = NULL;
+
+/*======== int aa_valid() ==========
+Inputs:   int samples
+Returns:  1 if there is a sample pattern for that count
+====================*/
+int aa_valid(int samples) {
+    return samples == 1 || samples == 2 || samples == 4 || samples == 8;
+}
+
+// Number of sample planes drawn into, 1 without -a
+int aa_count() {
+    return opts.aa > 1 ? opts.aa : 1;
+}
+
+static void aa_init() {
+    planes = malloc(opts.aa * sizeof(screen));
+    depths = malloc(opts.aa * sizeof(zbuffer));
+    for (int k = 0; k < opts.aa; k++) {
+        planes[k] = new_screen();
+        depths[k] = new_zbuffer();
+    }
+}
+
+screen * aa_screen(int k) {
+    return &planes[k];
+}
+
+zbuffer * aa_zbuffer(int k) {
+    return &depths[k];
+}
+
+/*======== void aa_offset() ==========
+Inputs:   int k
+          double * dx, double * dy
+Sets dx, dy to where sample k is in its pixel, or 0 for
+k = -1
+====================*/
+void aa_offset(int k, double * dx, double * dy) {
+    const int (*p)[2] = opts.aa == 2 ? pattern2 : opts.aa == 4 ? pattern4 : pattern8;
+
+    *dx = k < 0 ? 0 : p[k][0] / 16.0;
+    *dy = k < 0 ? 0 : p[k][1] / 16.0;
+}
+
+/*======== void aa_move() ==========
+Inputs:   struct matrix * points
+          int from, to
+Moves points drawn for sample from to where they are drawn
+for sample to. -1 is the original position.
+====================*/
+void aa_move(struct matrix * points, int from, int to) {
+    double fx, fy, tx, ty;
+
+    aa_offset(from, &fx, &fy);
+    aa_offset(to, &tx, &ty);
+
+    // plane pixel x samples the scene at x + dx
+    for (int i = 0; i < points -> lastcol; i++) {
+        points -> m[0][i] += fx - tx;
+        points -> m[1][i] += fy - ty;
+    }
+}
+
+/*======== void aa_clear() ==========
+Clears every sample plane, to go with clear_screen and
+clear_zbuffer
+====================*/
+void aa_clear() {
+    if (!planes) aa_init();
+
+    for (int k = 0; k < opts.aa; k++) {
+        clear_screen(planes[k]);
+        clear_zbuffer(depths[k]);
+    }
+}
+
+/*======== void aa_resolve() ==========
+Inputs:   screen s
+Averages the sample planes into s
+====================*/
+void aa_resolve(screen s) {
+    int n = XRES * YRES * sizeof(color);
+    int shift = opts.aa == 2 ? 1 : opts.aa == 4 ? 2 : 3;
+    // every screen is one block of rows, so it's averaged flat
+    unsigned char * out = (unsigned char *) s[0];
+    int i = 0;
+
+#if defined(__x86_64__) || defined(__i386__)
+    __m128i half = _mm_set1_epi16(opts.aa / 2);
+    __m128i zero = _mm_setzero_si128();
+
+    // 8 samples of 255 still fit in 16 bits
+    for (; i + 16 <= n; i += 16) {
+        __m128i lo = half, hi = half;
+
+        for (int k = 0; k < opts.aa; k++) {
+            unsigned char * in = (unsigned char *) planes[k][0];
+            __m128i v = _mm_loadu_si128((__m128i *) (in + i));
+
+            lo = _mm_add_epi16(lo, _mm_unpacklo_epi8(v, zero));
+            hi = _mm_add_epi16(hi, _mm_unpackhi_epi8(v, zero));
+        }
+        _mm_storeu_si128((__m128i *) (out + i),
+                         _mm_packus_epi16(_mm_srli_epi16(lo, shift), _mm_srli_epi16(hi, shift)));
+    }
+#endif
+
+    for (; i < n; i++) {
+        int sum = opts.aa / 2;
+
+        for (int k = 0; k < opts.aa; k++)
+            sum += ((unsigned char *) planes[k][0])[i];
+        out[i] = sum >> shift;
+    }
+}
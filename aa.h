@@ -0,0 +1,19 @@
+#ifndef AA_H
+#define AA_H
+
+#include "matrix.h"
+#include "ml6.h"
+
+// Most samples per pixel
+#define AA_MAX 8
+
+int aa_valid(int samples);
+int aa_count();
+screen * aa_screen(int k);
+zbuffer * aa_zbuffer(int k);
+void aa_offset(int k, double * dx, double * dy);
+void aa_move(struct matrix * points, int from, int to);
+void aa_clear();
+void aa_resolve(screen s);
+
+#endif
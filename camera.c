@@ -0,0 +1,565 @@
+/*====================== camera.c ========================
+The view and projection stage.
+
+Without a camera command the stack transform's output is
+the screen, as it's always been, and drawing is orthographic.
+A camera command puts the eye at a point looking at another,
+and everything is then drawn in perspective: after the
+stack transform each triangle goes into view space, is
+clipped to the near and far planes and to the sides of the
+view, and is projected. Focal sets how far in front of the
+eye the screen sits, in the script's units; by default it's
+at the aim, so things there come out the size they would
+without a camera. Depth is focal^2 over the distance from
+the eye, which is still greater for nearer points and, unlike
+the distance, interpolates exactly across the screen.
+
+The sides are clipped CAMERA_GUARD pixels outside the
+screen, so the edges clipping makes are never drawn and the
+rasterizers' own screen clipping does the rest.
+
+Lighting needs the normals from before the projection, which
+camera_project keeps for every triangle it outputs. Lights,
+the view vector and shadow maps all stay in the script's
+space, so only surface_normal and camera_unproject need to
+know there's a camera at all.
+
+Whole shapes are tested against the view before they're
+tessellated, camera or not: the sphere around their
+transformed bounds is checked against each plane, so a shape
+outside costs a few dot products.
+==================================================*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <float.h>
+
+#include "ml6.h"
+#include "draw.h"
+#include "gmath.h"
+#include "matrix.h"
+#include "camera.h"
+
+// Most doubles per corner camera_clip handles
+#define CLIP_STRIDE 8
+
+struct camera {
+    int active;
+    double eye[3];
+    double u[3], v[3], w[3];    // view basis, w points from the aim at the eye
+    double focal;
+    double planes[6][4];        // clip planes in view space
+};
+
+static struct camera cam;
+
+// every camera with -v, the one in cam is the one drawn from
+static struct camera cams[CAMERA_VIEWS];
+static int ncams = 0;
+
+struct camera_stats camera_stats;
+
+// camera_project's output and the normals of its triangles
+static struct matrix * projected = NULL;
+static double * normals = NULL;
+static int normals_size = 0;
+
+static struct matrix * projected_edges = NULL;
+
+static void cross(double * a, double * b, double * out) {
+    out[0] = a[1] * b[2] - a[2] * b[1];
+    out[1] = a[2] * b[0] - a[0] * b[2];
+    out[2] = a[0] * b[1] - a[1] * b[0];
+}
+
+/*======== int frustum() ==========
+Inputs:   double g (pixels outside the screen)
+          double planes[6][4]
+Returns:  The number of planes
+Sets planes to the sides (and with a camera, the near and
+far ends) of the view, each as a, b, c, d with a point
+inside where ax + by + cz + d >= 0. With a camera they're in
+view space, x, y and distance in front of the eye.
+====================*/
+static int frustum(double g, double planes[6][4]) {
+    double hx = XRES / 2.0 + g;
+    double hy = YRES / 2.0 + g;
+
+    if (!cam.active) {
+        double screen[4][4] = {
+            {1, 0, 0, g}, {-1, 0, 0, XRES + g},
+            {0, 1, 0, g}, {0, -1, 0, YRES + g},
+        };
+        memcpy(planes, screen, sizeof(screen));
+        return 4;
+    }
+
+    double f = cam.focal;
+    double view[6][4] = {
+        {0, 0, 1, -CAMERA_NEAR}, {0, 0, -1, CAMERA_FAR},
+        {f, 0, hx, 0}, {-f, 0, hx, 0},
+        {0, f, hy, 0}, {0, -f, hy, 0},
+    };
+    memcpy(planes, view, sizeof(view));
+    return 6;
+}
+
+static void to_view(double * p, double * out) {
+    double q[3] = {p[0] - cam.eye[0], p[1] - cam.eye[1], p[2] - cam.eye[2]};
+
+    out[0] = dot_product(q, cam.u);
+    out[1] = dot_product(q, cam.v);
+    out[2] = -dot_product(q, cam.w);
+}
+
+static void to_screen(double * q, double * out) {
+    double f = cam.focal;
+    double d = q[2];
+
+    out[0] = XRES / 2.0 + f * q[0] / d;
+    out[1] = YRES / 2.0 + f * q[1] / d;
+    out[2] = f * f / d;
+}
+
+static double plane_distance(double * plane, double * p) {
+    return plane[0] * p[0] + plane[1] * p[1] + plane[2] * p[2] + plane[3];
+}
+
+static void transform_point(struct matrix * t, double * p, double * out) {
+    for (int r = 0; r < 3; r++)
+        out[r] = t -> m[r][0] * p[0] + t -> m[r][1] * p[1] + t -> m[r][2] * p[2] + t -> m[r][3];
+}
+
+/*======== void camera_set() ==========
+Inputs:   double * eye
+          double * aim
+          double focal (0 for the distance to aim)
+Turns on perspective, looking from eye at aim with y up
+====================*/
+void camera_set(double * eye, double * aim, double focal) {
+    double up[3] = {0, 1, 0};
+    double w[3] = {eye[0] - aim[0], eye[1] - aim[1], eye[2] - aim[2]};
+    double dist = sqrt(dot_product(w, w));
+
+    if (dist == 0) {
+        printf("Camera ignored, its eye is at its aim\n");
+        return;
+    }
+
+    memcpy(cam.eye, eye, sizeof(cam.eye));
+    memcpy(cam.w, w, sizeof(cam.w));
+    normalize(cam.w);
+
+    // looking straight up or down, screen up is away from the viewer instead
+    if (fabs(cam.w[1]) > 0.999) {
+        up[1] = 0;
+        up[2] = -1;
+    }
+    cross(up, cam.w, cam.u);
+    normalize(cam.u);
+    cross(cam.w, cam.u, cam.v);
+
+    cam.focal = focal > 0 ? focal : dist;
+    cam.active = 1;
+    frustum(CAMERA_GUARD, cam.planes);
+}
+
+int camera_active() {
+    return cam.active;
+}
+
+/*======== int camera_add() ==========
+Inputs:   double * eye
+          double * aim
+          double focal
+Returns:  The camera's index for camera_select, or -1 if it
+          was ignored or there are CAMERA_VIEWS already
+camera_set, also keeping the camera for camera_select
+====================*/
+int camera_add(double * eye, double * aim, double focal) {
+    if (ncams == CAMERA_VIEWS) return -1;
+
+    cam.active = 0;
+    camera_set(eye, aim, focal);
+    if (!cam.active) return -1;
+
+    cams[ncams] = cam;
+    return ncams++;
+}
+
+int camera_count() {
+    return ncams;
+}
+
+/*======== void camera_select() ==========
+Inputs:   int k
+Draws from the kth camera camera_add kept from now on
+====================*/
+void camera_select(int k) {
+    cam = cams[k];
+}
+
+/*======== void camera_view() ==========
+Inputs:   double * view
+Points view at the eye, when there's a camera
+====================*/
+void camera_view(double * view) {
+    if (cam.active) memcpy(view, cam.w, sizeof(cam.w));
+}
+
+/*======== int sphere_in_view() ==========
+Inputs:   double * c
+          double r
+Returns:  0 if the sphere at c of radius r is entirely
+          outside the view
+====================*/
+static int sphere_in_view(double * c, double r) {
+    double q[3], planes[6][4];
+
+    memcpy(q, c, sizeof(q));
+    if (cam.active) to_view(c, q);
+
+    int n = frustum(CAMERA_MARGIN, planes);
+    for (int k = 0; k < n; k++) {
+        double len = sqrt(dot_product(planes[k], planes[k]));
+
+        if (plane_distance(planes[k], q) < -r * len) return 0;
+    }
+    return 1;
+}
+
+/*======== int camera_visible() ==========
+Inputs:   struct matrix * transform
+          double * lo
+          double * hi
+Returns:  0 if the shape in the box lo to hi (before
+          transform) is entirely outside the view
+====================*/
+int camera_visible(struct matrix * transform, double * lo, double * hi) {
+    double mid[3] = {(lo[0] + hi[0]) / 2, (lo[1] + hi[1]) / 2, (lo[2] + hi[2]) / 2};
+    double c[3];
+    double r = 0;
+
+    transform_point(transform, mid, c);
+    for (int corner = 0; corner < 8; corner++) {
+        double p[3] = {corner & 1 ? hi[0] : lo[0], corner & 2 ? hi[1] : lo[1],
+                       corner & 4 ? hi[2] : lo[2]};
+        double t[3];
+
+        transform_point(transform, p, t);
+        r = fmax(r, sqrt((t[0] - c[0]) * (t[0] - c[0]) + (t[1] - c[1]) * (t[1] - c[1])
+                         + (t[2] - c[2]) * (t[2] - c[2])));
+    }
+
+    camera_stats.objects_tested++;
+
+    // with several cameras a shape only has to be seen by one
+    struct camera current = cam;
+    int seen = 0;
+
+    for (int k = 0; k < (ncams > 1 ? ncams : 1) && !seen; k++) {
+        if (ncams > 1) cam = cams[k];
+        seen = sphere_in_view(c, r);
+    }
+    cam = current;
+
+    if (!seen) camera_stats.objects_culled++;
+    return seen;
+}
+
+/*======== int camera_bounds() ==========
+Inputs:   struct matrix * transform
+          double * lo, hi
+          double * bmin, bmax
+Returns:  0 if the box reaches behind the near plane
+transform_bounds, on the screen: bmin and bmax bound the box
+lo to hi once transformed and projected
+====================*/
+int camera_bounds(struct matrix * transform, double * lo, double * hi,
+                  double * bmin, double * bmax) {
+    if (!cam.active) {
+        transform_bounds(transform, lo, hi, bmin, bmax);
+        return 1;
+    }
+
+    for (int corner = 0; corner < 8; corner++) {
+        double p[3] = {corner & 1 ? hi[0] : lo[0], corner & 2 ? hi[1] : lo[1],
+                       corner & 4 ? hi[2] : lo[2]};
+        double t[3];
+
+        transform_point(transform, p, t);
+        to_view(t, t);
+        if (t[2] < CAMERA_NEAR) return 0;
+        to_screen(t, t);
+
+        for (int r = 0; r < 3; r++) {
+            if (corner == 0 || t[r] < bmin[r]) bmin[r] = t[r];
+            if (corner == 0 || t[r] > bmax[r]) bmax[r] = t[r];
+        }
+    }
+    return 1;
+}
+
+/*======== int camera_clip() ==========
+Inputs:   double * in (n corners, stride doubles each: a point,
+               then anything to interpolate along with it)
+          int n
+          int stride
+          double * out (room for CAMERA_CLIP_MAX corners)
+Returns:  The corners left after clipping, 0 if none
+Clips the polygon in to the view and projects what's left
+into out. Without a camera it's copied as is. A new corner
+is always found from the inside end of its edge, so the two
+triangles sharing an edge get exactly the same point.
+====================*/
+int camera_clip(double * in, int n, int stride, double * out) {
+    double a[CAMERA_CLIP_MAX * CLIP_STRIDE], b[CAMERA_CLIP_MAX * CLIP_STRIDE];
+    double * src = a, * dst = b;
+    int clipped = 0;
+
+    if (!cam.active) {
+        memcpy(out, in, n * stride * sizeof(double));
+        return n;
+    }
+
+    for (int i = 0; i < n; i++) {
+        to_view(in + i * stride, src + i * stride);
+        memcpy(src + i * stride + 3, in + i * stride + 3, (stride - 3) * sizeof(double));
+    }
+
+    for (int k = 0; k < 6; k++) {
+        double d[CAMERA_CLIP_MAX];
+        int inside = 0;
+
+        for (int i = 0; i < n; i++) {
+            d[i] = plane_distance(cam.planes[k], src + i * stride);
+            inside += d[i] >= 0;
+        }
+        if (inside == n) continue;
+        if (inside == 0) {
+            camera_stats.tris_dropped++;
+            return 0;
+        }
+
+        int m = 0;
+        for (int i = 0; i < n; i++) {
+            int j = (i + 1) % n;
+
+            if (d[i] >= 0) memcpy(dst + m++ * stride, src + i * stride, stride * sizeof(double));
+            if ((d[i] >= 0) != (d[j] >= 0)) {
+                int p = d[i] >= 0 ? i : j;
+                int q = d[i] >= 0 ? j : i;
+                double t = d[p] / (d[p] - d[q]);
+
+                for (int c = 0; c < stride; c++)
+                    dst[m * stride + c] = src[p * stride + c]
+                        + t * (src[q * stride + c] - src[p * stride + c]);
+                m++;
+            }
+        }
+
+        double * swap = src;
+        src = dst;
+        dst = swap;
+        n = m;
+        clipped = 1;
+    }
+    if (clipped) camera_stats.tris_clipped++;
+
+    for (int i = 0; i < n; i++) {
+        to_screen(src + i * stride, out + i * stride);
+        memcpy(out + i * stride + 3, src + i * stride + 3, (stride - 3) * sizeof(double));
+    }
+    return n;
+}
+
+/*======== struct matrix * camera_project() ==========
+Inputs:   struct matrix * polygons
+Returns:  The triangles of polygons clipped and projected
+          onto the screen, or polygons itself without a
+          camera. The result is reused by the next call.
+Clipped triangles come back as fans, wound the same way.
+====================*/
+struct matrix * camera_project(struct matrix * polygons) {
+    double ** m = polygons -> m;
+
+    if (!cam.active) return polygons;
+
+    if (!projected) projected = new_matrix(4, 1000);
+    projected -> lastcol = 0;
+
+    for (int col = 0; col < polygons -> lastcol - 2; col += 3) {
+        double in[9], out[3 * CAMERA_CLIP_MAX], normal[3];
+
+        for (int i = 0; i < 3; i++)
+            for (int r = 0; r < 3; r++)
+                in[3 * i + r] = m[r][col + i];
+
+        int n = camera_clip(in, 3, 3, out);
+        if (n < 3) continue;
+
+        if (projected -> lastcol + 3 * (n - 2) > projected -> cols)
+            grow_matrix(projected, 2 * projected -> cols + 3 * (n - 2));
+        if (projected -> cols > normals_size) {
+            normals_size = projected -> cols;
+            normals = realloc(normals, normals_size * sizeof(double));
+        }
+
+        calculate_normal(normal, polygons, col);
+        for (int t = 1; t < n - 1; t++) {
+            memcpy(normals + projected -> lastcol, normal, sizeof(normal));
+            add_point(projected, out[0], out[1], out[2]);
+            add_point(projected, out[3 * t], out[3 * t + 1], out[3 * t + 2]);
+            add_point(projected, out[3 * t + 3], out[3 * t + 4], out[3 * t + 5]);
+        }
+    }
+
+    return projected;
+}
+
+/*======== struct matrix * camera_project_edges() ==========
+Inputs:   struct matrix * edges
+Returns:  The edges clipped and projected onto the screen,
+          or edges itself without a camera. The result is
+          reused by the next call.
+====================*/
+struct matrix * camera_project_edges(struct matrix * edges) {
+    double ** m = edges -> m;
+
+    if (!cam.active) return edges;
+
+    if (!projected_edges) projected_edges = new_matrix(4, 100);
+    projected_edges -> lastcol = 0;
+
+    for (int col = 0; col < edges -> lastcol - 1; col += 2) {
+        double p[3] = {m[0][col], m[1][col], m[2][col]};
+        double q[3] = {m[0][col + 1], m[1][col + 1], m[2][col + 1]};
+        int outside = 0;
+
+        to_view(p, p);
+        to_view(q, q);
+        for (int k = 0; k < 6 && !outside; k++) {
+            double dp = plane_distance(cam.planes[k], p);
+            double dq = plane_distance(cam.planes[k], q);
+            double * cut = dp < 0 ? p : q;
+            double t = dp / (dp - dq);
+
+            if (dp < 0 && dq < 0) outside = 1;
+            else if (dp < 0 || dq < 0) {
+                for (int r = 0; r < 3; r++) cut[r] = p[r] + t * (q[r] - p[r]);
+            }
+        }
+        if (outside) continue;
+
+        to_screen(p, p);
+        to_screen(q, q);
+        add_edge(projected_edges, p[0], p[1], p[2], q[0], q[1], q[2]);
+    }
+
+    return projected_edges;
+}
+
+/*======== double * camera_normals() ==========
+Inputs:   struct matrix * polygons
+Returns:  The normals camera_project kept for polygons, 3 per
+          triangle at the triangle's column, or NULL if
+          polygons wasn't projected
+====================*/
+double * camera_normals(struct matrix * polygons) {
+    return cam.active && polygons == projected ? normals : NULL;
+}
+
+/*======== void surface_normal() ==========
+Inputs:   double * normal
+          struct matrix * polygons
+          int col
+Sets normal to the (unnormalized) normal to light the
+triangle at col with. It faces the same way as the one
+calculate_normal gives on the screen, but in perspective
+the screen's is bent, and this is the one from before.
+====================*/
+void surface_normal(double * normal, struct matrix * polygons, int col) {
+    double * n = camera_normals(polygons);
+
+    if (n) memcpy(normal, n + col, 3 * sizeof(double));
+    else calculate_normal(normal, polygons, col);
+}
+
+/*======== void camera_unproject() ==========
+Inputs:   double x, y, z (a pixel and its depth)
+          double * p
+Sets p to the point in the script's space that landed on
+the pixel
+====================*/
+void camera_unproject(double x, double y, double z, double * p) {
+    if (!cam.active) {
+        p[0] = x;
+        p[1] = y;
+        p[2] = z;
+        return;
+    }
+
+    double f = cam.focal;
+    double d = f * f / z;
+    double xv = (x - XRES / 2.0) * d / f;
+    double yv = (y - YRES / 2.0) * d / f;
+
+    for (int i = 0; i < 3; i++)
+        p[i] = cam.eye[i] + xv * cam.u[i] + yv * cam.v[i] - d * cam.w[i];
+}
+
+/*======== void camera_ray() ==========
+Inputs:   double x, y (a point on the screen)
+          double * origin, double * dir
+          double * range
+Sets origin and dir to the ray that lands on x, y, and range
+to the part of it that gets drawn. Without a camera it runs
+straight into the screen from depth 0, so everything in
+front of the screen is at negative distances along it.
+====================*/
+void camera_ray(double x, double y, double * origin, double * dir, double * range) {
+    if (!cam.active) {
+        origin[0] = x;
+        origin[1] = y;
+        origin[2] = 0;
+        dir[0] = 0;
+        dir[1] = 0;
+        dir[2] = -1;
+        range[0] = -DBL_MAX;
+        range[1] = DBL_MAX;
+        return;
+    }
+
+    double xv = x - XRES / 2.0, yv = y - YRES / 2.0;
+
+    for (int i = 0; i < 3; i++) {
+        origin[i] = cam.eye[i];
+        dir[i] = xv * cam.u[i] + yv * cam.v[i] - cam.focal * cam.w[i];
+    }
+    normalize(dir);
+
+    // the near and far planes are distances along -w, not the ray
+    double along = -dot_product(dir, cam.w);
+    range[0] = CAMERA_NEAR / along;
+    range[1] = CAMERA_FAR / along;
+}
+
+/*======== double camera_depth() ==========
+Inputs:   double * p (a point in the script's space)
+Returns:  The zbuffer depth p is drawn at
+====================*/
+double camera_depth(double * p) {
+    if (!cam.active) return p[2];
+
+    double q[3];
+    to_view(p, q);
+    return cam.focal * cam.focal / q[2];
+}
+
+void camera_print_stats() {
+    printf("Camera: culled %ld of %ld objects, clipped %ld triangles, dropped %ld\n",
+           camera_stats.objects_culled, camera_stats.objects_tested,
+           camera_stats.tris_clipped, camera_stats.tris_dropped);
+}
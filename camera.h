@@ -0,0 +1,47 @@
+#ifndef CAMERA_H
+#define CAMERA_H
+
+#include "matrix.h"
+
+// Nearest and farthest distances from the eye that get drawn
+#define CAMERA_NEAR 1.0
+#define CAMERA_FAR 100000.0
+// Pixels past each edge of the screen triangles are clipped at,
+// so no clipped edge ever lands on a pixel center
+#define CAMERA_GUARD 64
+// Pixels past each edge a whole object has to clear to be culled
+#define CAMERA_MARGIN 1
+// Most corners a triangle can have after clipping to 6 planes
+#define CAMERA_CLIP_MAX 9
+// Most cameras -v draws views from
+#define CAMERA_VIEWS 8
+
+struct camera_stats {
+    long objects_tested;
+    long objects_culled;
+    long tris_clipped;
+    long tris_dropped;
+};
+
+extern struct camera_stats camera_stats;
+
+void camera_set(double * eye, double * aim, double focal);
+int camera_active();
+int camera_add(double * eye, double * aim, double focal);
+int camera_count();
+void camera_select(int k);
+void camera_view(double * view);
+int camera_visible(struct matrix * transform, double * lo, double * hi);
+int camera_bounds(struct matrix * transform, double * lo, double * hi,
+                  double * bmin, double * bmax);
+int camera_clip(double * in, int n, int stride, double * out);
+struct matrix * camera_project(struct matrix * polygons);
+struct matrix * camera_project_edges(struct matrix * edges);
+double * camera_normals(struct matrix * polygons);
+void surface_normal(double * normal, struct matrix * polygons, int col);
+void camera_unproject(double x, double y, double z, double * p);
+void camera_ray(double x, double y, double * origin, double * dir, double * range);
+double camera_depth(double * p);
+void camera_print_stats();
+
+#endif
@@ -0,0 +1,197 @@
+/*====================== config.c ========================
+Parses the command line options for mdl.
+
+usage: ./mdl [-t threads] [-r scanline|simd|fixed] [-z] [-d] [-i] [-a 2|4|8] [-p] [-o] [-s] [-e] [-m] [-c megabytes] [-v] [-x WIDTHxHEIGHT] [-b] script.mdl
+==================================================*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "ml6.h"
+#include "config.h"
+#include "aa.h"
+#include "texture.h"
+
+struct options opts = {
+    1,                  // threads
+    RASTER_SCANLINE,    // raster
+    0,                  // hiz
+    0,                  // deferred
+    0,                  // impostors
+    1,                  // aa
+    0,                  // packed
+    0,                  // order
+    0,                  // spans
+    0,                  // prepass
+    0,                  // shadows
+    TEXTURE_BUDGET,     // texture_budget
+    0,                  // views
+    0,                  // traffic
+};
+
+/*======== void usage() ==========
+Inputs:   char * prog
+Prints the available options and exits
+====================*/
+static void usage(char * prog) {
+    fprintf(stderr, "usage: %s [-t threads] [-r scanline|simd|fixed] [-z] [-d] [-i] [-a 2|4|8] [-p] [-o] [-s] [-e] [-m] [-c megabytes] [-v] [-x WIDTHxHEIGHT] [-b] script.mdl\n", prog);
+    fprintf(stderr, "\t-t threads\tnumber of raster threads (tile binned if > 1)\n");
+    fprintf(stderr, "\t-r raster\ttriangle fill: scanline (default), simd edge functions\n");
+    fprintf(stderr, "\t\t\tor fixed point subpixel scanlines\n");
+    fprintf(stderr, "\t-z\t\thierarchical z-buffer occlusion culling\n");
+    fprintf(stderr, "\t-d\t\tdeferred shading, one lighting pass over visible pixels\n");
+    fprintf(stderr, "\t-i\t\tdraw spheres and tori analytically instead of tessellating\n");
+    fprintf(stderr, "\t-a samples\trotated grid supersampling, not with -z or -d\n");
+    fprintf(stderr, "\t-p\t\tfill objects in parallel into a packed depth+color buffer\n");
+    fprintf(stderr, "\t\t\t(scanline fill), not with -a or -d\n");
+    fprintf(stderr, "\t-o\t\tdraw spheres, tori and boxes front to back\n");
+    fprintf(stderr, "\t-s\t\tspan buffer instead of the zbuffer for filled triangles,\n");
+    fprintf(stderr, "\t\t\tnot with -a or -p\n");
+    fprintf(stderr, "\t-e\t\tdepth prepass, only triangles left visible get lit,\n");
+    fprintf(stderr, "\t\t\tnot with -a, -d, -p or -s\n");
+    fprintf(stderr, "\t-m\t\tshadow maps for every light, reused across frames\n");
+    fprintf(stderr, "\t\t\twhile nothing that casts changes (turns on -d), not with -a\n");
+    fprintf(stderr, "\t-c megabytes\ttexture cache budget (default %d)\n", TEXTURE_BUDGET);
+    fprintf(stderr, "\t-v\t\tan image from every camera, sharing one geometry pass,\n");
+    fprintf(stderr, "\t\t\tnot with -z, -d, -a, -p, -s, -e or -m\n");
+    fprintf(stderr, "\t-x size\t\timage size as WIDTHxHEIGHT (default %dx%d)\n",
+            DEFAULT_XRES, DEFAULT_YRES);
+    fprintf(stderr, "\t-b\t\tprint how much the framebuffer clears and saves moved\n");
+    exit(1);
+}
+
+/*======== int parse_args() ==========
+Inputs:   int argc
+          char ** argv
+Returns:  The index of the script file in argv
+Fills in opts from the command line
+====================*/
+int parse_args(int argc, char ** argv) {
+    int c;
+
+    while ((c = getopt(argc, argv, "t:r:zdia:posemc:vx:b")) != -1) {
+        switch (c) {
+            case 't':
+                opts.threads = atoi(optarg);
+                if (opts.threads < 1) opts.threads = 1;
+                break;
+
+            case 'r':
+                if (!strcmp(optarg, "scanline")) opts.raster = RASTER_SCANLINE;
+                else if (!strcmp(optarg, "simd")) opts.raster = RASTER_EDGE;
+                else if (!strcmp(optarg, "fixed")) opts.raster = RASTER_FIXED;
+                else usage(argv[0]);
+                break;
+
+            case 'z':
+                opts.hiz = 1;
+                break;
+
+            case 'd':
+                opts.deferred = 1;
+                break;
+
+            case 'i':
+                opts.impostors = 1;
+                break;
+
+            case 'a':
+                opts.aa = atoi(optarg);
+                if (!aa_valid(opts.aa)) usage(argv[0]);
+                break;
+
+            case 'p':
+                opts.packed = 1;
+                break;
+
+            case 'o':
+                opts.order = 1;
+                break;
+
+            case 's':
+                opts.spans = 1;
+                break;
+
+            case 'e':
+                opts.prepass = 1;
+                break;
+
+            case 'm':
+                opts.shadows = 1;
+                break;
+
+            case 'c':
+                opts.texture_budget = atoi(optarg);
+                if (opts.texture_budget < 0) opts.texture_budget = 0;
+                break;
+
+            case 'v':
+                opts.views = 1;
+                break;
+
+            case 'x':
+                if (sscanf(optarg, "%dx%d", &xres, &yres) != 2 ||
+                    xres < 1 || yres < 1 || xres > MAX_RES || yres > MAX_RES)
+                    usage(argv[0]);
+                break;
+
+            case 'b':
+                opts.traffic = 1;
+                break;
+
+            default:
+                usage(argv[0]);
+        }
+    }
+
+    if (optind >= argc) usage(argv[0]);
+
+    // each of these keeps a buffer every view would need its own of
+    if (opts.views && (opts.hiz || opts.deferred || opts.aa > 1 || opts.packed
+                       || opts.spans || opts.prepass || opts.shadows)) {
+        fprintf(stderr, "-v can't be combined with -z, -d, -a, -p, -s, -e or -m, ignoring them\n");
+        opts.hiz = 0;
+        opts.deferred = 0;
+        opts.aa = 1;
+        opts.packed = 0;
+        opts.spans = 0;
+        opts.prepass = 0;
+        opts.shadows = 0;
+    }
+
+    // shadows are looked up per pixel when the G-buffer is lit
+    if (opts.shadows && opts.aa > 1) {
+        fprintf(stderr, "-m can't be combined with -a, ignoring -m\n");
+        opts.shadows = 0;
+    }
+    if (opts.shadows) opts.deferred = 1;
+
+    // both keep a single buffer the sample planes would each need
+    if (opts.aa > 1 && (opts.hiz || opts.deferred)) {
+        fprintf(stderr, "-a can't be combined with -z or -d, ignoring them\n");
+        opts.hiz = 0;
+        opts.deferred = 0;
+    }
+
+    // packed pixels hold neither sample planes nor surface ids
+    if (opts.packed && (opts.aa > 1 || opts.deferred)) {
+        fprintf(stderr, "-p can't be combined with -a or -d, ignoring -p\n");
+        opts.packed = 0;
+    }
+
+    // spans replace the depth test the sample planes and packed words do
+    if (opts.spans && (opts.aa > 1 || opts.packed)) {
+        fprintf(stderr, "-s can't be combined with -a or -p, ignoring -s\n");
+        opts.spans = 0;
+    }
+
+    // each of these already decides visibility its own way
+    if (opts.prepass && (opts.aa > 1 || opts.deferred || opts.packed || opts.spans)) {
+        fprintf(stderr, "-e can't be combined with -a, -d, -p or -s, ignoring -e\n");
+        opts.prepass = 0;
+    }
+
+    return optind;
+}
@@ -0,0 +1,34 @@
+#ifndef CONFIG_H
+#define CONFIG_H
+
+// Triangle fill used by draw_polygons
+#define RASTER_SCANLINE 0
+#define RASTER_EDGE 1
+#define RASTER_FIXED 2
+
+/*
+  Render options that can be set from the command line.
+  Defaults reproduce the original single threaded renderer.
+*/
+struct options {
+    int threads;
+    int raster;
+    int hiz;
+    int deferred;
+    int impostors;
+    int aa;
+    int packed;
+    int order;
+    int spans;
+    int prepass;
+    int shadows;
+    int texture_budget;     // megabytes
+    int views;
+    int traffic;            // print framebuffer clear and save stats
+};
+
+extern struct options opts;
+
+int parse_args(int argc, char ** argv);
+
+#endif
@@ -1,9 +1,17 @@
 /*====================== display.c ========================
 Contains functions for basic manipulation of a screen
-represented as a 2 dimensional array of colors.
+represented as a 2 dimensional array of colors, stored a
+row at a time on the heap.
 
-A color is an ordered triple of ints, with each value standing
-for red, green and blue respectively
+A color is an ordered triple of bytes, with each value standing
+for red, green and blue respectively, plus an alpha byte.
+Depths are floats, so a pixel is 8 bytes of color and depth.
+The clears and saves, which stream whole buffers, are counted
+and timed for display_print_stats, which with -b also times a
+clear and save of the same size in the wider format pixels
+had before, 16 bit channels and double depths, next to a
+clear and save in this one, so the difference can be
+measured on any machine.
 ==================================================*/
 
 #include <stdio.h>
@@ -13,10 +21,79 @@ for red, green and blue respectively
 #include <limits.h>
 #include <string.h>
 #include <errno.h>
+#include <time.h>
 
 #include "ml6.h"
 #include "display.h"
 
+int xres = DEFAULT_XRES;
+int yres = DEFAULT_YRES;
+
+struct display_stats display_stats;
+
+// Rounds of each pass compare_formats times, keeping the fastest
+#define COMPARE_ROUNDS 5
+
+// A pixel's color as it was stored before RGBA8, with double depths
+struct wide_color {
+    unsigned short red;
+    unsigned short green;
+    unsigned short blue;
+};
+
+// Read by compare_formats so the passes it times aren't optimized out
+static volatile unsigned compare_sink;
+
+static double now_ms() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+/*======== void * new_rows() ==========
+Inputs:   int size (bytes per pixel)
+Returns:  YRES pointers to the rows of one XRES x YRES block
+          of pixels, aligned to SCREEN_ALIGN
+====================*/
+static void * new_rows(int size) {
+    char ** rows = malloc(YRES * sizeof(char *));
+    char * pixels;
+
+    if (rows == NULL || posix_memalign((void **) &pixels, SCREEN_ALIGN, (size_t) XRES * YRES * size)) {
+        fprintf(stderr, "Not enough memory for a %d x %d screen\n", XRES, YRES);
+        exit(1);
+    }
+
+    for (int y = 0; y < YRES; y++)
+        rows[y] = pixels + (size_t) y * XRES * size;
+    return rows;
+}
+
+/*======== screen new_screen() ==========
+Returns:  A screen of XRES x YRES pixels, not yet cleared
+====================*/
+screen new_screen() {
+    return new_rows(sizeof(color));
+}
+
+/*======== zbuffer new_zbuffer() ==========
+Returns:  A zbuffer of XRES x YRES depths, not yet cleared
+====================*/
+zbuffer new_zbuffer() {
+    return new_rows(sizeof(float));
+}
+
+// Frees a screen or zbuffer from new_screen or new_zbuffer
+void free_screen(screen s) {
+    free(s[0]);
+    free(s);
+}
+
+void free_zbuffer(zbuffer zb) {
+    free(zb[0]);
+    free(zb);
+}
 
 /*======== void plot() ==========
 Inputs:   screen s
@@ -28,14 +105,15 @@ Sets the color at pixel x, y to the color represented by c
 Note that s[0][0] will be the upper left hand corner
 of the screen.
 If you wish to change this behavior, you can change the indicies
-of s that get set. For example, using s[x][YRES-1-y] will have
+of s that get set. For example, using s[YRES-1-y][x] will have
 pixel 0, 0 located at the lower left corner of the screen
 ====================*/
 void plot( screen s, zbuffer zb, color c, int x, int y, double z) {
     int newy = YRES - 1 - y;
-    if ( x >= 0 && x < XRES && newy >=0 && newy < YRES  && z > zb[x][newy] ) {
-        s[x][newy] = c;
-        zb[x][newy] = z;
+    float zf = z;
+    if ( x >= 0 && x < XRES && newy >=0 && newy < YRES  && zf > zb[newy][x] ) {
+        s[newy][x] = c;
+        zb[newy][x] = zf;
     }
 }
 
@@ -47,14 +125,20 @@ Sets every color in screen s to black
 void clear_screen( screen s ) {
     int x, y;
     color c;
+    double start = now_ms();
 
     c.red = DEFAULT_COLOR;
     c.green = DEFAULT_COLOR;
     c.blue = DEFAULT_COLOR;
+    c.alpha = MAX_COLOR;
 
     for ( y=0; y < YRES; y++ )
         for ( x=0; x < XRES; x++)
-            s[x][y] = c;
+            s[y][x] = c;
+
+    display_stats.clears++;
+    display_stats.clear_bytes += (long) XRES * YRES * sizeof(color);
+    display_stats.clear_ms += now_ms() - start;
 }
 
 /*======== void clear_zbuffer() ==========
@@ -64,10 +148,14 @@ Sets all entries in the zbufffer to LONG_MIN
 ====================*/
 void clear_zbuffer( zbuffer zb ) {
     int x, y;
+    double start = now_ms();
 
     for ( y=0; y < YRES; y++ )
         for ( x=0; x < XRES; x++)
-            zb[x][y] = LONG_MIN;
+            zb[y][x] = LONG_MIN;
+
+    display_stats.clear_bytes += (long) XRES * YRES * sizeof(float);
+    display_stats.clear_ms += now_ms() - start;
 }
 
 /*======== void save_ppm() ==========
@@ -79,21 +167,24 @@ Saves screen s as a valid ppm file using the settings in ml6.h
 void save_ppm( screen s, char *file) {
     int x, y;
     int fd;
-    char header[16];
-    unsigned char pixel[3];
+    char header[32];
+    unsigned char * row = malloc(XRES * 3);
 
-    fd = open(file, O_CREAT | O_WRONLY, 0644);
+    fd = open(file, O_CREAT | O_WRONLY | O_TRUNC, 0644);
     sprintf(header, "P6\n%d %d\n%d\n", XRES, YRES, MAX_COLOR);
-    write(fd, header, sizeof(header) - 1);
+    write(fd, header, strlen(header));
+    // a row at a time, now that rows are contiguous
     for ( y=0; y < YRES; y++ ) {
         for ( x=0; x < XRES; x++) {
-            pixel[0] = s[x][y].red;
-            pixel[1] = s[x][y].green;
-            pixel[2] = s[x][y].blue;
-            write(fd, pixel, sizeof(pixel));
+            row[3 * x] = s[y][x].red;
+            row[3 * x + 1] = s[y][x].green;
+            row[3 * x + 2] = s[y][x].blue;
         }
+        write(fd, row, XRES * 3);
     }
     close(fd);
+    free(row);
+    display_stats.saves++;
 }
 
 /*======== void save_ppm_ascii() ==========
@@ -112,10 +203,11 @@ void save_ppm_ascii( screen s, char *file) {
     for ( y=0; y < YRES; y++ ) {
         for ( x=0; x < XRES; x++)
 
-        fprintf(f, "%d %d %d ", s[x][y].red, s[x][y].green, s[x][y].blue);
+        fprintf(f, "%d %d %d ", s[y][x].red, s[y][x].green, s[y][x].blue);
         fprintf(f, "\n");
     }
     fclose(f);
+    display_stats.saves++;
 }
 
 /*======== void save_extension() ==========
@@ -139,10 +231,11 @@ void save_extension( screen s, char *file) {
     for ( y=0; y < YRES; y++ ) {
         for ( x=0; x < XRES; x++)
 
-        fprintf(f, "%d %d %d ", s[x][y].red, s[x][y].green, s[x][y].blue);
+        fprintf(f, "%d %d %d ", s[y][x].red, s[y][x].green, s[y][x].blue);
         fprintf(f, "\n");
     }
     pclose(f);
+    display_stats.saves++;
 }
 
 
@@ -161,7 +254,7 @@ void display( screen s) {
     for ( y=0; y < YRES; y++ ) {
         for ( x=0; x < XRES; x++)
 
-        fprintf(f, "%d %d %d ", s[x][y].red, s[x][y].green, s[x][y].blue);
+        fprintf(f, "%d %d %d ", s[y][x].red, s[y][x].green, s[y][x].blue);
         fprintf(f, "\n");
     }
     pclose(f);
@@ -180,3 +273,107 @@ void make_animation( char * name ) {
         printf("e: %d errno: %d: %s\n", e, errno, strerror(errno));
     }
 }
+
+/*======== void compare_formats() ==========
+Inputs:   double * ms
+Clears a fresh XRES x YRES screen and zbuffer, and packs the
+screen into rows of RGB bytes the way save_ppm does (without
+the file, whose cost doesn't depend on the format), in both
+the current and the wide format. Each pass runs
+COMPARE_ROUNDS times and ms gets the fastest: clear and save
+of the current format, then clear and save of the wide one.
+====================*/
+static void compare_formats(double * ms) {
+    screen s = new_screen();
+    zbuffer zb = new_zbuffer();
+    struct wide_color ** ws = new_rows(sizeof(struct wide_color));
+    double ** wzb = new_rows(sizeof(double));
+    unsigned char * row = malloc(3 * XRES);
+    color c = {DEFAULT_COLOR, DEFAULT_COLOR, DEFAULT_COLOR, MAX_COLOR};
+    struct wide_color wc = {DEFAULT_COLOR, DEFAULT_COLOR, DEFAULT_COLOR};
+    unsigned sum = 0;
+
+    for (int k = 0; k < 4; k++) ms[k] = -1;
+
+    for (int round = 0; round < COMPARE_ROUNDS; round++) {
+        double t[5];
+
+        t[0] = now_ms();
+        for (int y = 0; y < YRES; y++)
+            for (int x = 0; x < XRES; x++)
+                s[y][x] = c;
+        for (int y = 0; y < YRES; y++)
+            for (int x = 0; x < XRES; x++)
+                zb[y][x] = LONG_MIN;
+
+        t[1] = now_ms();
+        for (int y = 0; y < YRES; y++) {
+            for (int x = 0; x < XRES; x++) {
+                row[3 * x] = s[y][x].red;
+                row[3 * x + 1] = s[y][x].green;
+                row[3 * x + 2] = s[y][x].blue;
+            }
+            sum += row[0] + row[3 * XRES - 1];
+        }
+
+        t[2] = now_ms();
+        for (int y = 0; y < YRES; y++)
+            for (int x = 0; x < XRES; x++)
+                ws[y][x] = wc;
+        for (int y = 0; y < YRES; y++)
+            for (int x = 0; x < XRES; x++)
+                wzb[y][x] = LONG_MIN;
+
+        t[3] = now_ms();
+        for (int y = 0; y < YRES; y++) {
+            for (int x = 0; x < XRES; x++) {
+                row[3 * x] = ws[y][x].red;
+                row[3 * x + 1] = ws[y][x].green;
+                row[3 * x + 2] = ws[y][x].blue;
+            }
+            sum += row[0] + row[3 * XRES - 1];
+        }
+        t[4] = now_ms();
+
+        sum += zb[YRES - 1][XRES - 1] < wzb[YRES - 1][XRES - 1];
+        for (int k = 0; k < 4; k++)
+            if (ms[k] < 0 || t[k + 1] - t[k] < ms[k]) ms[k] = t[k + 1] - t[k];
+    }
+    compare_sink = sum;
+
+    free(row);
+    free_screen(s);
+    free_zbuffer(zb);
+    free(ws[0]);
+    free(ws);
+    free(wzb[0]);
+    free(wzb);
+}
+
+/*======== void display_print_stats() ==========
+Prints how much the clears wrote and how fast, and how much
+the saves read, the whole buffer streaming per frame. Then
+compares a clear and save in the current format with the
+wide one at the same size.
+====================*/
+void display_print_stats() {
+    double mb = display_stats.clear_bytes / 1e6;
+    double rate = display_stats.clear_ms > 0 ? mb / display_stats.clear_ms : 0;
+    double pixels = (double) XRES * YRES;
+    double ms[4];
+
+    printf("Framebuffer: %dx%d, %d bytes of color and %d of depth a pixel\n",
+           XRES, YRES, (int) sizeof(color), (int) sizeof(float));
+    printf("Framebuffer: %ld clears wrote %.1f MB in %.2f ms (%.2f GB/s), %ld saves read %.1f MB\n",
+           display_stats.clears, mb, display_stats.clear_ms, rate, display_stats.saves,
+           display_stats.saves * pixels * sizeof(color) / 1e6);
+
+    compare_formats(ms);
+    printf("Framebuffer: one frame at %dx%d, fastest of %d:\n", XRES, YRES, COMPARE_ROUNDS);
+    printf("Framebuffer:   RGBA8 + float:  clear writes %6.1f MB in %6.2f ms, save reads %6.1f MB in %6.2f ms\n",
+           pixels * (sizeof(color) + sizeof(float)) / 1e6, ms[0],
+           pixels * sizeof(color) / 1e6, ms[1]);
+    printf("Framebuffer:   RGB16 + double: clear writes %6.1f MB in %6.2f ms, save reads %6.1f MB in %6.2f ms\n",
+           pixels * (sizeof(struct wide_color) + sizeof(double)) / 1e6, ms[2],
+           pixels * sizeof(struct wide_color) / 1e6, ms[3]);
+}
@@ -3,6 +3,19 @@
 
 #include "ml6.h"
 
+struct display_stats {
+    long clears;
+    long saves;
+    long clear_bytes;   // screens and zbuffers
+    double clear_ms;
+};
+
+extern struct display_stats display_stats;
+
+screen new_screen();
+zbuffer new_zbuffer();
+void free_screen(screen s);
+void free_zbuffer(zbuffer zb);
 void plot( screen s, zbuffer zb, color c, int x, int y, double z);
 void clear_screen( screen s);
 void clear_zbuffer( zbuffer zb );
@@ -11,5 +24,6 @@ void save_ppm_ascii( screen s, char *file);
 void save_extension( screen s, char *file);
 void display( screen s);
 void make_animation( char * name);
+void display_print_stats();
 
 #endif
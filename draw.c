@@ -1,6 +1,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <math.h>
+#include <string.h>
 
 #include "ml6.h"
 #include "display.h"
@@ -8,6 +9,19 @@
 #include "matrix.h"
 #include "gmath.h"
 #include "symtab.h"
+#include "config.h"
+#include "tiles.h"
+#include "hiz.h"
+#include "gbuffer.h"
+#include "setup.h"
+#include "wire.h"
+#include "aa.h"
+#include "packed.h"
+#include "span.h"
+#include "prepass.h"
+#include "shade.h"
+#include "camera.h"
+#include "views.h"
 
 /*======== void draw_scanline() ==========
   Inputs: struct matrix *points
@@ -19,12 +33,27 @@
   ====================*/
 void draw_scanline( double x0, double z0, double x1, double z1, int y, double offx,
                     screen s, zbuffer zb, color c) {
+    struct rect full = {0, 0, XRES, YRES};
+    draw_scanline_clip(x0, z0, x1, z1, y, offx, s, zb, c, &full);
+}
+
+/*======== void draw_scanline_clip() ==========
+  Inputs: same as draw_scanline
+          struct rect * clip
+  Only plots the pixels of the scanline inside clip.
+  z is still stepped through the skipped pixels so the
+  depth of every plotted pixel is bit for bit the same
+  as an unclipped draw_scanline.
+  ====================*/
+void draw_scanline_clip( double x0, double z0, double x1, double z1, int y, double offx,
+                         screen s, zbuffer zb, color c, struct rect * clip) {
     if (x0 > x1) {
         swap(&x0, &x1);
         swap(&z0, &z1);
     }
 
     int x = ceil(x0);
+    int xend = ceil(x1);
 
     double mz = 0;
     if ((x1 - x0) > 0) {
@@ -33,9 +62,27 @@ void draw_scanline( double x0, double z0, double x1, double z1, int y, double of
 
     double z = z0 + mz * offx;
 
-    while (x < ceil(x1)) {
-        plot(s, zb, c, x, y, z);
-        
+    if (xend > clip -> x1) xend = clip -> x1;
+    while (x < clip -> x0 && x < xend) {
+        z += mz;
+        x++;
+    }
+
+    // the whole span is one row, so look it up once instead of
+    // per pixel through plot
+    int row = YRES - 1 - y;
+    if (row < 0 || row >= YRES) return;
+    color * sp = s[row];
+    float * zp = zb[row];
+
+    while (x < xend) {
+        float zf = z;
+
+        if (zf > zp[x]) {
+            zp[x] = zf;
+            sp[x] = c;
+        }
+
         z += mz;
         x++;
     }
@@ -52,6 +99,20 @@ void draw_scanline( double x0, double z0, double x1, double z1, int y, double of
   Includes Greg's pixel perfect scanning
   ====================*/
 void scanline_convert(struct matrix * points, int col, screen s, zbuffer zbuff, color c) {
+    struct rect full = {0, 0, XRES, YRES};
+    scanline_convert_clip(points, col, s, zbuff, c, &full);
+}
+
+/*======== void scanline_convert_clip() ==========
+  Inputs: same as scanline_convert
+          struct rect * clip
+  Returns:
+  Fills in the part of polygon i that lies inside clip.
+  Rows below the clip are stepped but not drawn, so the
+  result inside clip matches scanline_convert exactly.
+  ====================*/
+void scanline_convert_clip(struct matrix * points, int col, screen s, zbuffer zbuff,
+                           color c, struct rect * clip) {
     double ** matrix = points -> m;
     double xb = matrix[0][col];
     double xm = matrix[0][col + 1];
@@ -100,9 +161,12 @@ void scanline_convert(struct matrix * points, int col, screen s, zbuffer zbuff,
     double z1 = zb + mz1 * offy0;
     double z2 = zm + mz2 * offy1;
     int y = ceil(yb);
+    int ytop = ceil(yt);
+
+    if (ytop > clip -> y1) ytop = clip -> y1;
 
     int toggle = 1;
-    while (y < ceil(yt)) {
+    while (y < ytop) {
         double offx;
 
         if (y == ceil(ym) && toggle) {
@@ -114,12 +178,14 @@ void scanline_convert(struct matrix * points, int col, screen s, zbuffer zbuff,
             toggle = 0;
         }
 
-        if (x0 > x1) {
-            offx = ceil(x1) - x1;
-        }
-        else offx = ceil(x0) - x0;
+        if (y >= clip -> y0) {
+            if (x0 > x1) {
+                offx = ceil(x1) - x1;
+            }
+            else offx = ceil(x0) - x0;
 
-        draw_scanline(x0, z0, x1, z1, y, offx, s, zbuff, c);
+            draw_scanline_clip(x0, z0, x1, z1, y, offx, s, zbuff, c, clip);
+        }
         x0 += mx0;
         x1 += mx1;
         z0 += mz0;
@@ -152,6 +218,156 @@ void add_polygon(struct matrix * polygons,
     add_point(polygons, x2, y2, z2);
 }
 
+int shading_mode = SHADE_FLAT;
+
+/*======== void draw_triangles() ==========
+Inputs:   struct matrix * polygons
+          struct triangles * tris
+          shade_fn fill
+          screen s
+          zbuffer zb
+Fills the triangles set up from polygons, in order
+====================*/
+static void draw_triangles(struct matrix * polygons, struct triangles * tris,
+                           shade_fn fill, screen s, zbuffer zb) {
+    struct rect full = {0, 0, XRES, YRES};
+
+    for (int t = 0; t < tris -> count; t++)
+        fill(polygons, tris, t, s, zb, &full);
+}
+
+/*======== int smooth_shading() ==========
+Inputs:   int mode (SHADE_GOURAUD or SHADE_PHONG)
+Returns:  mode, or SHADE_FLAT if the options keep a single
+          color per triangle
+The G-buffer lights per surface, spans hold one color, and
+packed and prepass triangles are queued already lit flat, so
+with -d (or -m), -s, -p or -e these shade flat, and are
+tessellated at the flat step. Warns the first time.
+====================*/
+static int smooth_shading(int mode) {
+    static int warned = 0;
+    char * flag = opts.shadows ? "-m" : opts.deferred ? "-d" : opts.spans ? "-s" :
+                  opts.packed ? "-p" : opts.prepass ? "-e" : NULL;
+
+    if (!flag) return mode;
+
+    if (!warned) {
+        fprintf(stderr, "%s can't be combined with gouraud or phong shading, shading flat\n", flag);
+        warned = 1;
+    }
+    return SHADE_FLAT;
+}
+
+/*======== int shading_type() ==========
+Inputs:   char * name
+Returns:  The shading mode for a shading command's name.
+          Anything else shades flat, and so do gouraud and
+          phong when the options can't interpolate.
+====================*/
+int shading_type(char * name) {
+    if (!strcmp(name, "wireframe")) return SHADE_WIREFRAME;
+    if (!strcmp(name, "gouraud")) return smooth_shading(SHADE_GOURAUD);
+    if (!strcmp(name, "phong")) return smooth_shading(SHADE_PHONG);
+    if (!strcmp(name, "raytrace")) return SHADE_RAYTRACE;
+    return SHADE_FLAT;
+}
+
+// v truncated and limited to 0 to MAX_COLOR, before it's narrowed to a byte
+static int channel(double v) {
+    int c = v;
+
+    return c < 0 ? 0 : c > MAX_COLOR ? MAX_COLOR : c;
+}
+
+/*======== color wire_color() ==========
+Inputs:   struct constants * reflect
+Returns:  The color wireframes of a material are drawn in,
+          its diffuse reflection of white light
+====================*/
+static color wire_color(struct constants * reflect) {
+    color c;
+
+    change_color(&c, channel(MAX_COLOR * reflect -> r[DIFFUSE_R]),
+                 channel(MAX_COLOR * reflect -> g[DIFFUSE_R]),
+                 channel(MAX_COLOR * reflect -> b[DIFFUSE_R]));
+    return c;
+}
+
+/*======== void draw_view() ==========
+  Inputs:   the same as draw_polygons
+  Draws polygons from the selected camera
+  ====================*/
+static void draw_view( struct matrix * polygons, screen s, zbuffer zb,
+                       double * view, struct lights * lights, color ambient,
+                       struct constants * reflect) {
+    // with a camera, clipped and projected onto the screen first
+    polygons = camera_project(polygons);
+
+    // deferred shading fills surface ids into the G-buffer instead
+    if (opts.deferred) s = gbuffer;
+
+    if (shading_mode == SHADE_WIREFRAME) {
+        color c = wire_color(reflect);
+
+        if (opts.deferred) c = gbuffer_flat(c);
+        for (int k = 0; k < aa_count(); k++) {
+            if (opts.aa > 1) {
+                aa_move(polygons, k - 1, k);
+                s = *aa_screen(k);
+                zb = *aa_zbuffer(k);
+            }
+            draw_wireframe(polygons, s, zb, c);
+        }
+        if (opts.aa > 1) aa_move(polygons, aa_count() - 1, -1);
+
+        if (opts.hiz) hiz_dirty(0, 0, XRES - 1, YRES - 1);
+        return;
+    }
+
+    if (opts.hiz) hiz_update(zb);
+
+    // queued and rasterized later, in parallel with other objects
+    if (opts.packed) {
+        packed_submit(polygons, view, lights, ambient, reflect);
+        return;
+    }
+
+    // queued unlit, drawn depth first at the next flush
+    if (opts.prepass) {
+        prepass_submit(polygons, view, lights, ambient, reflect);
+        return;
+    }
+
+    // only front facing triangles come back, already lit
+    struct shader sh = shader_select(shading_mode);
+    struct triangles * tris = sh.setup(polygons, view, lights, ambient, reflect);
+
+    // kept as per row spans until span_resolve
+    if (opts.spans) {
+        span_triangles(polygons, tris);
+        return;
+    }
+
+    // with -a the same triangles are filled into every sample plane
+    for (int k = 0; k < aa_count(); k++) {
+        if (opts.aa > 1) {
+            aa_move(polygons, k - 1, k);
+            s = *aa_screen(k);
+            zb = *aa_zbuffer(k);
+        }
+
+        if (opts.threads > 1) draw_triangles_tiled(polygons, tris, sh.fill, s, zb);
+        else draw_triangles(polygons, tris, sh.fill, s, zb);
+    }
+    if (opts.aa > 1) aa_move(polygons, aa_count() - 1, -1);
+
+    if (opts.hiz) {
+        for (int t = 0; t < tris -> count; t++)
+            hiz_dirty_triangle(polygons, tris -> cols[t]);
+    }
+}
+
 /*======== void draw_polygons() ==========
   Inputs:   struct matrix *polygons
             screen s
@@ -161,7 +377,7 @@ void add_polygon(struct matrix * polygons,
   lines connecting each points to create bounding triangles
   ====================*/
 void draw_polygons( struct matrix * polygons, screen s, zbuffer zb, 
-                    double * view, double light[2][3], color ambient,
+                    double * view, struct lights * lights, color ambient,
                     struct constants * reflect) {
     int lastcol = polygons -> lastcol;
 
@@ -170,15 +386,16 @@ void draw_polygons( struct matrix * polygons, screen s, zbuffer zb,
         return;
     }
 
-    for (int col = 0; col < lastcol - 2; col += 3) {
-        double * normal = calculate_normal(polygons, col);
+    // with -v the same triangles are drawn from every camera, view 0 last
+    for (int k = views_count() - 1; k > 0; k--) {
+        double v[3];
 
-        if (normal[2] > 0) {
-            // get color value only if front facing
-            color clight = get_lighting(normal, view, ambient, light, reflect);
-            scanline_convert(polygons, col, s, zb, clight);
-        }
+        views_select(k, v);
+        draw_view(polygons, *views_screen(k), *views_zbuffer(k), v, lights, ambient, reflect);
     }
+    if (views_count() > 1) views_select(0, NULL);
+
+    draw_view(polygons, s, zb, view, lights, ambient, reflect);
 }
 
 /*======== void add_box() ==========
@@ -222,6 +439,24 @@ void add_box(struct matrix * polygons,
     add_polygon(polygons, x1, y1, z, x, y1, z1, x1, y1, z1);
 }
 
+/*======== void box_bounds() ==========
+  Inputs:   double x, y, z, width, height, depth
+            double * lo
+            double * hi
+  Fills lo and hi with the corners of the axis aligned
+  box around add_box's output, before any transform
+  ====================*/
+void box_bounds(double x, double y, double z,
+                double width, double height, double depth,
+                double * lo, double * hi) {
+    lo[0] = fmin(x, x + width);
+    hi[0] = fmax(x, x + width);
+    lo[1] = fmin(y, y - height);
+    hi[1] = fmax(y, y - height);
+    lo[2] = fmin(z, z - depth);
+    hi[2] = fmax(z, z - depth);
+}
+
 /*======== void add_sphere() ==========
   Inputs:   struct matrix * points
             double cx
@@ -273,6 +508,23 @@ void add_sphere(struct matrix * polygons,
     free_matrix(sphere);
 }
 
+/*======== void sphere_bounds() ==========
+  Inputs:   double cx, cy, cz, r
+            double * lo
+            double * hi
+  Box around the sphere, before any transform
+  ====================*/
+void sphere_bounds(double cx, double cy, double cz, double r,
+                   double * lo, double * hi) {
+    r = fabs(r);
+    lo[0] = cx - r;
+    lo[1] = cy - r;
+    lo[2] = cz - r;
+    hi[0] = cx + r;
+    hi[1] = cy + r;
+    hi[2] = cz + r;
+}
+
 /*======== void generate_sphere() ==========
   Inputs:   struct matrix * points
             double cx
@@ -357,6 +609,25 @@ void add_torus( struct matrix * polygons,
     free_matrix(torus);
 }
 
+/*======== void torus_bounds() ==========
+  Inputs:   double cx, cy, cz, r1, r2
+            double * lo
+            double * hi
+  Box around the torus generate_torus makes: the ring
+  lies in the xz plane, the tube is r1 thick in y
+  ====================*/
+void torus_bounds(double cx, double cy, double cz, double r1, double r2,
+                  double * lo, double * hi) {
+    double ring = fabs(r1) + fabs(r2);
+
+    lo[0] = cx - ring;
+    lo[1] = cy - fabs(r1);
+    lo[2] = cz - ring;
+    hi[0] = cx + ring;
+    hi[1] = cy + fabs(r1);
+    hi[2] = cz + ring;
+}
+
 /*======== void generate_torus() ==========
   Inputs:   struct matrix * points
             double cx
@@ -499,6 +770,35 @@ void add_edge(struct matrix * points,
     add_point(points, x1, y1, z1);
 }
 
+/*======== void draw_lines_to() ==========
+Inputs:   struct matrix * points
+          screen s
+          zbuffer zb
+          color c
+Returns:
+The loop of draw_lines, for one target
+====================*/
+static void draw_lines_to(struct matrix * points, screen s, zbuffer zb, color c) {
+    int lastcol = points -> lastcol;
+
+    for (int point = 0; point < lastcol - 1; point += 2) {
+        int x0 = points -> m[0][point];
+        int y0 = points -> m[1][point];
+        double z0 = points -> m[2][point];
+        int x1 = points -> m[0][point + 1];
+        int y1 = points -> m[1][point + 1];
+        double z1 = points -> m[2][point + 1];
+
+        // plot would reject every pixel of a line entirely off one side
+        if ((x0 < 0 && x1 < 0) || (x0 >= XRES && x1 >= XRES) ||
+            (y0 < 0 && y1 < 0) || (y0 >= YRES && y1 >= YRES)) continue;
+
+        draw_line(x0, y0, z0, x1, y1, z1, s, zb, c);
+
+        if (opts.hiz) hiz_dirty(fmin(x0, x1), fmin(y0, y1), fmax(x0, x1), fmax(y0, y1));
+    }
+}
+
 /*======== void draw_lines() ==========
 Inputs:   struct matrix * points
 screen s
@@ -515,16 +815,28 @@ void draw_lines(struct matrix * points, screen s, zbuffer zb, color c) {
         return;
     }
 
-    for (int point = 0; point < lastcol - 1; point += 2) {
-        int x0 = points -> m[0][point];
-        int y0 = points -> m[1][point];
-        double z0 = points -> m[2][point];
-        int x1 = points -> m[0][point + 1];
-        int y1 = points -> m[1][point + 1];
-        double z1 = points -> m[2][point + 1];
+    // -v has no -d or -a, so each view is just projected and drawn
+    for (int k = views_count() - 1; k > 0; k--) {
+        views_select(k, NULL);
+        draw_lines_to(camera_project_edges(points), *views_screen(k), *views_zbuffer(k), c);
+    }
+    if (views_count() > 1) views_select(0, NULL);
 
-        draw_line(x0, y0, z0, x1, y1, z1, s, zb, c);
+    points = camera_project_edges(points);
+
+    if (opts.deferred) {
+        s = gbuffer;
+        c = gbuffer_flat(c);
+    }
+
+    for (int k = 0; k < aa_count(); k++) {
+        if (opts.aa > 1) {
+            aa_move(points, k - 1, k);
+            draw_lines_to(points, *aa_screen(k), *aa_zbuffer(k), c);
+        }
+        else draw_lines_to(points, s, zb, c);
     }
+    if (opts.aa > 1) aa_move(points, aa_count() - 1, -1);
 }
 
 void draw_line( int x0, int y0, double z0, int x1, int y1, double z1, 
@@ -649,6 +961,7 @@ void change_color(color * c, int r, int g, int b) {
     c -> red = r;
     c -> green = g;
     c -> blue = b;
+    c -> alpha = MAX_COLOR;
 }
 //======== swap (double *a, double *b) ==========
 void swap(double *a, double *b) {
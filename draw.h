@@ -4,11 +4,32 @@
 #include "matrix.h"
 #include "ml6.h"
 #include "symtab.h"
+#include "gmath.h"
+
+// Half open pixel rectangle [x0, x1) x [y0, y1), y before the flip in plot
+struct rect {
+    int x0, y0;
+    int x1, y1;
+};
+
+// Shading modes, picked by the shading command
+#define SHADE_FLAT 0
+#define SHADE_WIREFRAME 1
+#define SHADE_GOURAUD 2
+#define SHADE_PHONG 3
+#define SHADE_RAYTRACE 4
+
+extern int shading_mode;
+int shading_type(char * name);
 
 // Scanline
 void draw_scanline( double x0, double z0, double x1, double z1, int y, double offx,
                     screen s, zbuffer zb, color c);
+void draw_scanline_clip( double x0, double z0, double x1, double z1, int y, double offx,
+                         screen s, zbuffer zb, color c, struct rect * clip);
 void scanline_convert(struct matrix * points, int col, screen s, zbuffer zb, color c);
+void scanline_convert_clip(struct matrix * points, int col, screen s, zbuffer zb,
+                           color c, struct rect * clip);
 
 // Polygon organization
 void add_polygons( struct matrix * polygons,
@@ -16,7 +37,7 @@ void add_polygons( struct matrix * polygons,
                    double x1, double y1, double z1,
                    double x2, double y2, double z2);
 void draw_polygons( struct matrix * polygons, screen s, zbuffer zb, 
-                    double * view, double light[2][3], color ambient,
+                    double * view, struct lights * lights, color ambient,
                     struct constants * reflect);
 
 // Advanced shapes
@@ -35,6 +56,15 @@ void add_torus( struct matrix * edges,
 struct matrix * generate_torus( double cx, double cy, double cz,
                                 double r1, double r2, int step );
 
+// Untransformed bounding boxes of the 3D shapes
+void box_bounds(double x, double y, double z,
+                double width, double height, double depth,
+                double * lo, double * hi);
+void sphere_bounds(double cx, double cy, double cz, double r,
+                   double * lo, double * hi);
+void torus_bounds(double cx, double cy, double cz, double r1, double r2,
+                  double * lo, double * hi);
+
 // 2D Curves
 void add_circle(struct matrix * points,
                 double cx, double cy, double cz,
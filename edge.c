@@ -0,0 +1,391 @@
+/*====================== edge.c ========================
+Edge function triangle rasterizer.
+
+Instead of walking edges like scanline_convert, every pixel
+in the triangle's bounding box is tested against the three
+edge functions E(x, y) = a * x + b * y + c, and depth comes
+from the triangle's plane equation.
+
+The coverage rule is the top-left form of the ceil based
+"pixel perfect" scanning: a pixel center on the boundary
+belongs to the triangle only if it sits on a left edge (or
+on a flat bottom edge), the way a scanline includes ceil(x0)
+but stops before ceil(x1), and starts at ceil(yb) but stops
+before ceil(yt). It is not bit for bit the scanline fill:
+scanline_convert steps x down each edge, and on a sloped
+edge that rounding can put a pixel center near the edge on
+the other side, so the two can differ by a pixel along
+sloped edges. Horizontal and vertical edges on whole pixel
+coordinates come out the same.
+
+screen and zbuffer are stored a row at a time, s[y][x], so
+the vector kernels walk each row of the bounding box 8
+pixels at a time: AVX2 as two 4 wide double vectors, SSE2 as
+four 2 wide ones. Depth is rounded to float, as stored, and
+tested and written 8 lanes at a time, with masked stores on
+AVX2; colors (one 32 bit word per pixel) are written only
+for the lanes that passed. The scalar code evaluates the
+edges with the same arithmetic, so the result doesn't depend
+on the kernel.
+==================================================*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "ml6.h"
+#include "draw.h"
+#include "edge.h"
+#include "matrix.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define EDGE_X86
+#include <immintrin.h>
+#endif
+
+#define BLOCK 8
+
+struct edge_setup {
+    double a[3], b[3], c[3];
+    int incl[3];
+    double dzdx, dzdy, zc;
+    int x0, x1;     // columns, inclusive
+    int n0, n1;     // rows after the flip in plot, [n0, n1)
+};
+
+typedef void (*edge_fill)(struct edge_setup * t, screen s, zbuffer zb, color c);
+
+/*======== int edge_setup() ==========
+Inputs:   struct edge_setup * t
+          struct matrix * points
+          int col
+          struct rect * clip
+Returns:  0 if there is nothing to draw
+Computes the edge equations, depth plane and clipped
+bounding box of the triangle at col
+====================*/
+static int edge_setup(struct edge_setup * t, struct matrix * points, int col,
+                      struct rect * clip) {
+    double ** m = points -> m;
+    double x[3], y[3], z[3];
+
+    for (int i = 0; i < 3; i++) {
+        x[i] = m[0][col + i];
+        y[i] = m[1][col + i];
+        z[i] = m[2][col + i];
+    }
+
+    double area = (x[1] - x[0]) * (y[2] - y[0]) - (x[2] - x[0]) * (y[1] - y[0]);
+    if (area == 0) return 0;
+
+    // make the triangle counter clockwise so the inside is E > 0
+    if (area < 0) {
+        swap(&x[1], &x[2]);
+        swap(&y[1], &y[2]);
+        swap(&z[1], &z[2]);
+        area = -area;
+    }
+
+    for (int k = 0; k < 3; k++) {
+        int j = (k + 1) % 3;
+        t -> a[k] = y[k] - y[j];
+        t -> b[k] = x[j] - x[k];
+        t -> c[k] = -(t -> a[k] * x[k] + t -> b[k] * y[k]);
+        t -> incl[k] = t -> a[k] > 0 || (t -> a[k] == 0 && t -> b[k] > 0);
+    }
+
+    t -> dzdx = ((z[1] - z[0]) * (y[2] - y[0]) - (z[2] - z[0]) * (y[1] - y[0])) / area;
+    t -> dzdy = ((x[1] - x[0]) * (z[2] - z[0]) - (x[2] - x[0]) * (z[1] - z[0])) / area;
+    t -> zc = z[0] - t -> dzdx * x[0] - t -> dzdy * y[0];
+
+    int bx0 = ceil(fmin(x[0], fmin(x[1], x[2])));
+    int bx1 = floor(fmax(x[0], fmax(x[1], x[2])));
+    int by0 = ceil(fmin(y[0], fmin(y[1], y[2])));
+    int by1 = floor(fmax(y[0], fmax(y[1], y[2])));
+
+    if (bx0 < clip -> x0) bx0 = clip -> x0;
+    if (by0 < clip -> y0) by0 = clip -> y0;
+    if (bx1 > clip -> x1 - 1) bx1 = clip -> x1 - 1;
+    if (by1 > clip -> y1 - 1) by1 = clip -> y1 - 1;
+    if (bx0 > bx1 || by0 > by1) return 0;
+
+    t -> x0 = bx0;
+    t -> x1 = bx1;
+    t -> n0 = YRES - 1 - by1;
+    t -> n1 = YRES - by0;
+
+    return 1;
+}
+
+/*
+  Every row is evaluated at its own y, whatever the clip, so
+  every pixel gets the same arithmetic in the tiled and
+  untiled renderers. Nothing is stepped from row to row:
+  a stepped edge picks up rounding error, and a pixel
+  center exactly on an edge would land on either side of it
+  instead of being decided by incl.
+*/
+
+// The parts of the edges and depth that are the same along a row
+struct edge_row {
+    double by[3];       // b * y
+    double zy;          // dzdy * y
+};
+
+/*======== void row_setup() ==========
+Inputs:   struct edge_setup * t
+          struct edge_row * r
+          int n
+Sets r up for row n, which is y = YRES - 1 - n
+====================*/
+static void row_setup(struct edge_setup * t, struct edge_row * r, int n) {
+    double y = YRES - 1 - n;
+
+    for (int k = 0; k < 3; k++)
+        r -> by[k] = t -> b[k] * y;
+    r -> zy = t -> dzdy * y;
+}
+
+/*======== void fill_span_scalar() ==========
+Handles pixels lo to hi - 1 of row n
+====================*/
+static void fill_span_scalar(struct edge_setup * t, struct edge_row * r,
+                             color * sp, float * zp, color c, int lo, int hi) {
+    for (int x = lo; x < hi; x++) {
+        int in = 1;
+
+        for (int k = 0; k < 3; k++) {
+            double ei = t -> a[k] * x + r -> by[k] + t -> c[k];
+            if (ei < 0 || (ei == 0 && !t -> incl[k])) in = 0;
+        }
+
+        float zi = t -> zc + t -> dzdx * x + r -> zy;
+        if (in && zi > zp[x]) {
+            zp[x] = zi;
+            sp[x] = c;
+        }
+    }
+}
+
+static void fill_scalar(struct edge_setup * t, screen s, zbuffer zb, color c) {
+    struct edge_row r;
+
+    for (int n = t -> n0; n < t -> n1; n++) {
+        row_setup(t, &r, n);
+        fill_span_scalar(t, &r, s[n], zb[n], c, t -> x0, t -> x1 + 1);
+    }
+}
+
+#ifdef EDGE_X86
+
+__attribute__((target("avx2")))
+static void fill_avx2(struct edge_setup * t, screen s, zbuffer zb, color c) {
+    const __m256d zero = _mm256_setzero_pd();
+    const __m256d lane_lo = _mm256_set_pd(3, 2, 1, 0);
+    const __m256d lane_hi = _mm256_set_pd(7, 6, 5, 4);
+    __m256d a[3], cc[3], incl[3];
+    struct edge_row r;
+
+    for (int k = 0; k < 3; k++) {
+        a[k] = _mm256_set1_pd(t -> a[k]);
+        cc[k] = _mm256_set1_pd(t -> c[k]);
+        incl[k] = _mm256_castsi256_pd(_mm256_set1_epi64x(t -> incl[k] ? -1 : 0));
+    }
+    __m256d zc = _mm256_set1_pd(t -> zc);
+    __m256d dzdx = _mm256_set1_pd(t -> dzdx);
+    __m256d end = _mm256_set1_pd(t -> x1);
+    // the low 32 bits of each 64 bit mask lane, in order
+    const __m256i narrow = _mm256_setr_epi32(0, 2, 4, 6, 0, 2, 4, 6);
+
+    for (int n = t -> n0; n < t -> n1; n++) {
+        color * sp = s[n];
+        float * zrow = zb[n];
+        __m256d by[3];
+
+        row_setup(t, &r, n);
+        for (int k = 0; k < 3; k++) {
+            by[k] = _mm256_set1_pd(r.by[k]);
+        }
+        __m256d zy = _mm256_set1_pd(r.zy);
+
+        for (int x = t -> x0; x <= t -> x1; x += BLOCK) {
+            __m256d xv = _mm256_set1_pd(x);
+            __m256d xlo = _mm256_add_pd(xv, lane_lo);
+            __m256d xhi = _mm256_add_pd(xv, lane_hi);
+            __m256d in_lo = _mm256_cmp_pd(xlo, end, _CMP_LE_OQ);
+            __m256d in_hi = _mm256_cmp_pd(xhi, end, _CMP_LE_OQ);
+
+            for (int k = 0; k < 3; k++) {
+                __m256d elo = _mm256_add_pd(_mm256_add_pd(
+                    _mm256_mul_pd(a[k], xlo), by[k]), cc[k]);
+                __m256d ehi = _mm256_add_pd(_mm256_add_pd(
+                    _mm256_mul_pd(a[k], xhi), by[k]), cc[k]);
+                __m256d mlo = _mm256_or_pd(_mm256_cmp_pd(elo, zero, _CMP_GT_OQ),
+                                           _mm256_and_pd(incl[k], _mm256_cmp_pd(elo, zero, _CMP_EQ_OQ)));
+                __m256d mhi = _mm256_or_pd(_mm256_cmp_pd(ehi, zero, _CMP_GT_OQ),
+                                           _mm256_and_pd(incl[k], _mm256_cmp_pd(ehi, zero, _CMP_EQ_OQ)));
+                in_lo = _mm256_and_pd(in_lo, mlo);
+                in_hi = _mm256_and_pd(in_hi, mhi);
+            }
+            if (!(_mm256_movemask_pd(in_lo) | _mm256_movemask_pd(in_hi))) continue;
+
+            __m256d zlo = _mm256_add_pd(_mm256_add_pd(
+                zc, _mm256_mul_pd(dzdx, xlo)), zy);
+            __m256d zhi = _mm256_add_pd(_mm256_add_pd(
+                zc, _mm256_mul_pd(dzdx, xhi)), zy);
+            __m256 z = _mm256_set_m128(_mm256_cvtpd_ps(zhi), _mm256_cvtpd_ps(zlo));
+            __m256i in = _mm256_set_m128i(
+                _mm256_castsi256_si128(_mm256_permutevar8x32_epi32(_mm256_castpd_si256(in_hi), narrow)),
+                _mm256_castsi256_si128(_mm256_permutevar8x32_epi32(_mm256_castpd_si256(in_lo), narrow)));
+            float * zp = zrow + x;
+
+            // masked lanes are never touched, so blocks hanging
+            // over the clip or the end of the row are safe
+            __m256 old = _mm256_maskload_ps(zp, in);
+            __m256 pass = _mm256_and_ps(_mm256_castsi256_ps(in), _mm256_cmp_ps(z, old, _CMP_GT_OQ));
+
+            _mm256_maskstore_ps(zp, _mm256_castps_si256(pass), z);
+
+            unsigned bits = _mm256_movemask_ps(pass);
+            while (bits) {
+                sp[x + __builtin_ctz(bits)] = c;
+                bits &= bits - 1;
+            }
+        }
+    }
+}
+
+__attribute__((target("sse2")))
+static void fill_sse2(struct edge_setup * t, screen s, zbuffer zb, color c) {
+    const __m128d zero = _mm_setzero_pd();
+    __m128d a[3], cc[3], incl[3], lane[4];
+    struct edge_row r;
+
+    for (int k = 0; k < 3; k++) {
+        a[k] = _mm_set1_pd(t -> a[k]);
+        cc[k] = _mm_set1_pd(t -> c[k]);
+        incl[k] = _mm_castsi128_pd(_mm_set1_epi32(t -> incl[k] ? -1 : 0));
+    }
+    for (int j = 0; j < 4; j++)
+        lane[j] = _mm_set_pd(2 * j + 1, 2 * j);
+    __m128d zc = _mm_set1_pd(t -> zc);
+    __m128d dzdx = _mm_set1_pd(t -> dzdx);
+
+    for (int n = t -> n0; n < t -> n1; n++) {
+        color * sp = s[n];
+        float * zrow = zb[n];
+        __m128d by[3];
+        int x;
+
+        row_setup(t, &r, n);
+        for (int k = 0; k < 3; k++) {
+            by[k] = _mm_set1_pd(r.by[k]);
+        }
+        __m128d zy = _mm_set1_pd(r.zy);
+
+        for (x = t -> x0; x + BLOCK <= t -> x1 + 1; x += BLOCK) {
+            __m128d xv = _mm_set1_pd(x);
+            __m128d xs[4], in[4];
+            int any = 0;
+
+            for (int j = 0; j < 4; j++) {
+                xs[j] = _mm_add_pd(xv, lane[j]);
+                in[j] = _mm_cmpeq_pd(zero, zero);
+            }
+
+            for (int k = 0; k < 3; k++) {
+                for (int j = 0; j < 4; j++) {
+                    __m128d ej = _mm_add_pd(_mm_add_pd(
+                        _mm_mul_pd(a[k], xs[j]), by[k]), cc[k]);
+                    __m128d mj = _mm_or_pd(_mm_cmpgt_pd(ej, zero),
+                                           _mm_and_pd(incl[k], _mm_cmpeq_pd(ej, zero)));
+                    in[j] = _mm_and_pd(in[j], mj);
+                }
+            }
+            for (int j = 0; j < 4; j++)
+                any |= _mm_movemask_pd(in[j]);
+            if (!any) continue;
+
+            float * zp = zrow + x;
+            unsigned bits = 0;
+
+            // the whole block is inside the clip, so writing back
+            // the old depth for the failed lanes can't race a tile.
+            // Depth goes 4 floats at a time, from pairs of lanes.
+            for (int h = 0; h < 2; h++) {
+                __m128d z0 = _mm_add_pd(_mm_add_pd(
+                    zc, _mm_mul_pd(dzdx, xs[2 * h])), zy);
+                __m128d z1 = _mm_add_pd(_mm_add_pd(
+                    zc, _mm_mul_pd(dzdx, xs[2 * h + 1])), zy);
+                __m128 z = _mm_movelh_ps(_mm_cvtpd_ps(z0), _mm_cvtpd_ps(z1));
+                __m128 inh = _mm_shuffle_ps(_mm_castpd_ps(in[2 * h]), _mm_castpd_ps(in[2 * h + 1]),
+                                            _MM_SHUFFLE(2, 0, 2, 0));
+                __m128 old = _mm_loadu_ps(zp + 4 * h);
+                __m128 pass = _mm_and_ps(inh, _mm_cmpgt_ps(z, old));
+
+                _mm_storeu_ps(zp + 4 * h, _mm_or_ps(_mm_and_ps(pass, z),
+                                                    _mm_andnot_ps(pass, old)));
+                bits |= _mm_movemask_ps(pass) << (4 * h);
+            }
+            while (bits) {
+                sp[x + __builtin_ctz(bits)] = c;
+                bits &= bits - 1;
+            }
+        }
+
+        // SSE2 has no masked load, the last partial block goes scalar
+        fill_span_scalar(t, &r, sp, zrow, c, x, t -> x1 + 1);
+    }
+}
+
+#endif
+
+static edge_fill kernel = NULL;
+static const char * kernel_name;
+
+/*======== void edge_init() ==========
+Chooses the widest kernel the cpu supports. Called from
+the serial part of draw_polygons, before any tile work.
+====================*/
+void edge_init() {
+    if (kernel != NULL) return;
+
+    kernel = fill_scalar;
+    kernel_name = "scalar";
+#ifdef EDGE_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        kernel = fill_avx2;
+        kernel_name = "avx2";
+    }
+    else if (__builtin_cpu_supports("sse2")) {
+        kernel = fill_sse2;
+        kernel_name = "sse2";
+    }
+#endif
+}
+
+/*======== void edge_convert_clip() ==========
+  Inputs: struct matrix *points
+          int col
+          screen s
+          zbuffer zb
+          color c
+          struct rect * clip
+  Returns:
+  Fills in the part of polygon col inside clip using
+  edge functions. Drop in replacement for scanline_convert_clip.
+  ====================*/
+void edge_convert_clip(struct matrix * points, int col, screen s, zbuffer zb,
+                       color c, struct rect * clip) {
+    struct edge_setup t;
+
+    if (edge_setup(&t, points, col, clip))
+        kernel(&t, s, zb, c);
+}
+
+// Name of the kernel in use, for the stats printout
+const char * edge_kernel_name() {
+    edge_init();
+    return kernel_name;
+}
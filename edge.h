@@ -0,0 +1,13 @@
+#ifndef EDGE_H
+#define EDGE_H
+
+#include "matrix.h"
+#include "ml6.h"
+#include "draw.h"
+
+void edge_init();
+void edge_convert_clip(struct matrix * points, int col, screen s, zbuffer zb,
+                       color c, struct rect * clip);
+const char * edge_kernel_name();
+
+#endif
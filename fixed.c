@@ -0,0 +1,203 @@
+/*====================== fixed.c ========================
+Fixed point subpixel scanline rasterizer.
+
+Vertices are snapped to a grid of 1 / 2^SUBPIXEL_BITS of a
+pixel, after which everything is integer math: the edges
+are walked with an exact quotient and remainder (a
+Bresenham style DDA) instead of adding a rounded slope each
+row, and depth is a fixed point plane stepped with integer
+adds.
+
+Coverage is the same rule as scanline_convert: a row y is
+drawn when yb <= y < yt, and a pixel x when x0 <= x < x1
+for the row's edge crossings x0 and x1. Here those crossings
+are exact, so two triangles that share an edge compute the
+same ceiling for it and every pixel along the edge belongs
+to exactly one of them: no cracks and no double hits.
+Results don't depend on the order rows are visited, so the
+tiled renderer matches the serial one exactly.
+==================================================*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "ml6.h"
+#include "draw.h"
+#include "fixed.h"
+#include "matrix.h"
+
+#define ONE (1 << SUBPIXEL_BITS)
+#define DEPTH_ONE (1 << DEPTH_BITS)
+
+// Beyond this (in pixels, or depth per pixel) the products
+// below could overflow
+#define FIXED_LIMIT (1 << 20)
+
+typedef long long fixed;
+
+struct fixed_edge {
+    fixed q, r;     // crossing is q + r / d
+    fixed d;
+    fixed sq, sr;   // added to q, r every row
+};
+
+static fixed floor_div(fixed a, fixed b) {
+    fixed q = a / b;
+    if ((a % b != 0) && ((a < 0) != (b < 0))) q--;
+    return q;
+}
+
+static fixed ceil_div(fixed a, fixed b) {
+    return -floor_div(-a, b);
+}
+
+/*======== void edge_start() ==========
+Inputs:   struct fixed_edge * e
+          fixed x0, y0, x1, y1 (subpixels, y0 < y1)
+          int y
+Sets up e to give the crossing of the edge with row y, in
+pixels, as an exact fraction
+====================*/
+static void edge_start(struct fixed_edge * e, fixed x0, fixed y0,
+                       fixed x1, fixed y1, int y) {
+    fixed dx = x1 - x0;
+    fixed dy = y1 - y0;
+    fixed n = x0 * dy + ((fixed) y * ONE - y0) * dx;
+
+    e -> d = dy * ONE;
+    e -> q = floor_div(n, e -> d);
+    e -> r = n - e -> q * e -> d;
+    e -> sq = floor_div(dx * ONE, e -> d);
+    e -> sr = dx * ONE - e -> sq * e -> d;
+}
+
+static void edge_step(struct fixed_edge * e) {
+    e -> q += e -> sq;
+    e -> r += e -> sr;
+    if (e -> r >= e -> d) {
+        e -> r -= e -> d;
+        e -> q++;
+    }
+}
+
+// First pixel at or right of the crossing
+static int edge_ceil(struct fixed_edge * e) {
+    return e -> q + (e -> r > 0);
+}
+
+/*======== void fixed_convert_clip() ==========
+  Inputs: struct matrix *points
+          int col
+          screen s
+          zbuffer zb
+          color c
+          struct rect * clip
+  Returns:
+  Fills in the part of polygon col inside clip, using
+  fixed point edges and depth.
+  ====================*/
+void fixed_convert_clip(struct matrix * points, int col, screen s, zbuffer zb,
+                        color c, struct rect * clip) {
+    double ** m = points -> m;
+    fixed x[3], y[3];
+    double z[3];
+
+    for (int i = 0; i < 3; i++) {
+        if (fabs(m[0][col + i]) > FIXED_LIMIT || fabs(m[1][col + i]) > FIXED_LIMIT) {
+            scanline_convert_clip(points, col, s, zb, c, clip);
+            return;
+        }
+        x[i] = llround(m[0][col + i] * ONE);
+        y[i] = llround(m[1][col + i] * ONE);
+        z[i] = m[2][col + i];
+    }
+
+    // sort into bottom (0), middle (1) and top (2)
+    for (int i = 0; i < 2; i++) {
+        for (int j = 0; j < 2 - i; j++) {
+            if (y[j] > y[j + 1]) {
+                fixed t;
+                t = x[j]; x[j] = x[j + 1]; x[j + 1] = t;
+                t = y[j]; y[j] = y[j + 1]; y[j + 1] = t;
+                swap(&z[j], &z[j + 1]);
+            }
+        }
+    }
+
+    fixed area = (x[2] - x[0]) * (y[1] - y[0]) - (x[1] - x[0]) * (y[2] - y[0]);
+    if (area == 0) return;
+
+    // depth plane, in pixels, converted to fixed point once
+    double fx1 = (double) (x[1] - x[0]) / ONE;
+    double fy1 = (double) (y[1] - y[0]) / ONE;
+    double fx2 = (double) (x[2] - x[0]) / ONE;
+    double fy2 = (double) (y[2] - y[0]) / ONE;
+    double det = fx1 * fy2 - fx2 * fy1;
+    double dzdx = ((z[1] - z[0]) * fy2 - (z[2] - z[0]) * fy1) / det;
+    double dzdy = (fx1 * (z[2] - z[0]) - fx2 * (z[1] - z[0])) / det;
+
+    // slivers so thin the depth slope won't fit in fixed point
+    if (fabs(dzdx) > FIXED_LIMIT || fabs(dzdy) > FIXED_LIMIT) {
+        scanline_convert_clip(points, col, s, zb, c, clip);
+        return;
+    }
+
+    int xref = (x[0] + ONE / 2) >> SUBPIXEL_BITS;
+    int yref = (y[0] + ONE / 2) >> SUBPIXEL_BITS;
+    double zplane = z[0] + dzdx * (xref - (double) x[0] / ONE)
+                         + dzdy * (yref - (double) y[0] / ONE);
+    fixed zref = llround(zplane * DEPTH_ONE);
+    fixed zdx = llround(dzdx * DEPTH_ONE);
+    fixed zdy = llround(dzdy * DEPTH_ONE);
+
+    int ystart = ceil_div(y[0], ONE);
+    int ymid = ceil_div(y[1], ONE);
+    int yend = ceil_div(y[2], ONE);
+
+    if (ystart < clip -> y0) ystart = clip -> y0;
+    if (yend > clip -> y1) yend = clip -> y1;
+    if (ystart >= yend) return;
+
+    // the long edge is on the left when the middle vertex is on the right
+    int long_left = area < 0;
+    struct fixed_edge lng, shrt;
+    int upper = ystart >= ymid;
+
+    edge_start(&lng, x[0], y[0], x[2], y[2], ystart);
+    if (upper)
+        edge_start(&shrt, x[1], y[1], x[2], y[2], ystart);
+    else
+        edge_start(&shrt, x[0], y[0], x[1], y[1], ystart);
+
+    for (int row = ystart; row < yend; row++) {
+        if (row == ymid && !upper) {
+            edge_start(&shrt, x[1], y[1], x[2], y[2], row);
+            upper = 1;
+        }
+
+        int xl = edge_ceil(long_left ? &lng : &shrt);
+        int xr = edge_ceil(long_left ? &shrt : &lng);
+
+        if (xl < clip -> x0) xl = clip -> x0;
+        if (xr > clip -> x1) xr = clip -> x1;
+
+        if (xl < xr) {
+            int n = YRES - 1 - row;
+            fixed zf = zref + zdx * (xl - xref) + zdy * (row - yref);
+
+            for (int px = xl; px < xr; px++) {
+                float zp = (double) zf / DEPTH_ONE;
+
+                if (zp > zb[n][px]) {
+                    zb[n][px] = zp;
+                    s[n][px] = c;
+                }
+                zf += zdx;
+            }
+        }
+
+        edge_step(&lng);
+        edge_step(&shrt);
+    }
+}
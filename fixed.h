@@ -0,0 +1,16 @@
+#ifndef FIXED_H
+#define FIXED_H
+
+#include "matrix.h"
+#include "ml6.h"
+#include "draw.h"
+
+// Vertices snap to 1 / 2^SUBPIXEL_BITS of a pixel
+#define SUBPIXEL_BITS 8
+// Depth is stepped with DEPTH_BITS of fraction
+#define DEPTH_BITS 16
+
+void fixed_convert_clip(struct matrix * points, int col, screen s, zbuffer zb,
+                        color c, struct rect * clip);
+
+#endif
@@ -0,0 +1,227 @@
+/*====================== gbuffer.c ========================
+G-buffer for deferred shading.
+
+In deferred mode the raster pass doesn't light anything.
+Each front facing triangle gets a surface id holding its
+normal and material, and the id is packed into the color
+handed to the fill, so every raster kernel writes it into
+gbuffer unchanged, z-testing against the real zbuffer as
+usual. Lines get flat colored surfaces so they still hide
+and get hidden correctly.
+
+gbuffer_resolve then lights each covered pixel once, from
+whichever surface won its depth test, and writes screen.
+Flat shading gives the same color for every pixel of a
+surface, so the image matches forward shading exactly, but
+hidden triangles never pay for lighting.
+==================================================*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ml6.h"
+#include "display.h"
+#include "gmath.h"
+#include "symtab.h"
+#include "pool.h"
+#include "config.h"
+#include "shadow.h"
+#include "camera.h"
+#include "gbuffer.h"
+
+// Rows of the screen resolved by one pool task
+#define RESOLVE_ROWS 16
+
+struct material {
+    int flat;
+    color c;
+    struct constants * reflect;
+    color ambient;
+    struct lights * lights;
+    double view[3];
+};
+
+struct surface {
+    double normal[3];
+    int material;
+};
+
+struct gbuffer_stats gbuffer_stats;
+screen gbuffer = NULL;
+
+static struct surface * surfaces = NULL;
+static int nsurfaces = 1;
+static int surfaces_size = 0;
+
+static struct material * materials = NULL;
+static int nmaterials = 0;
+static int materials_size = 0;
+
+// The lights of each material, prepared by gbuffer_resolve
+static struct lighting ** prepared = NULL;
+static int prepared_size = 0;
+
+// Id 0 is an empty pixel. Ids take all 4 bytes of the color.
+static color encode(int id) {
+    color c;
+
+    c.red = id & 0xff;
+    c.green = id >> 8 & 0xff;
+    c.blue = id >> 16 & 0xff;
+    c.alpha = id >> 24 & 0xff;
+    return c;
+}
+
+static int decode(color c) {
+    return c.red | c.green << 8 | c.blue << 16 | (unsigned) c.alpha << 24;
+}
+
+/*======== void gbuffer_clear() ==========
+Empties the G-buffer and forgets every surface, to go with
+clear_zbuffer
+====================*/
+void gbuffer_clear() {
+    if (!gbuffer) gbuffer = new_screen();
+    memset(gbuffer[0], 0, (size_t) XRES * YRES * sizeof(color));
+    nsurfaces = 1;
+    nmaterials = 0;
+}
+
+/*======== int add_material() ==========
+Inputs:   struct material * mat
+Returns:  The index of mat in the material table
+Consecutive draws nearly always share a material, so only
+the last one is checked before adding a new one
+====================*/
+static int add_material(struct material * mat) {
+    if (nmaterials > 0 && !memcmp(&materials[nmaterials - 1], mat, sizeof(struct material)))
+        return nmaterials - 1;
+
+    if (nmaterials == materials_size) {
+        materials_size = materials_size ? materials_size * 2 : 16;
+        materials = realloc(materials, materials_size * sizeof(struct material));
+    }
+    memcpy(&materials[nmaterials], mat, sizeof(struct material));
+    return nmaterials++;
+}
+
+static color add_surface(double * normal, int material) {
+    if (nsurfaces >= surfaces_size) {
+        surfaces_size = surfaces_size ? surfaces_size * 2 : 1024;
+        surfaces = realloc(surfaces, surfaces_size * sizeof(struct surface));
+    }
+    memcpy(surfaces[nsurfaces].normal, normal, 3 * sizeof(double));
+    surfaces[nsurfaces].material = material;
+    gbuffer_stats.surfaces++;
+
+    return encode(nsurfaces++);
+}
+
+/*======== color gbuffer_surface() ==========
+Inputs:   same lighting inputs as get_lighting
+Returns:  The color to fill a triangle with so it lands in
+          gbuffer as a new surface
+====================*/
+color gbuffer_surface(double * normal, double * view, color ambient,
+                      struct lights * lights, struct constants * reflect) {
+    struct material mat;
+
+    memset(&mat, 0, sizeof(mat));
+    mat.reflect = reflect;
+    mat.ambient = ambient;
+    mat.lights = lights;
+    memcpy(mat.view, view, sizeof(mat.view));
+
+    return add_surface(normal, add_material(&mat));
+}
+
+/*======== color gbuffer_flat() ==========
+Inputs:   color c
+Returns:  The color to draw with so the pixels resolve to c
+          without lighting
+====================*/
+color gbuffer_flat(color c) {
+    struct material mat;
+    double normal[3] = {0, 0, 0};
+
+    memset(&mat, 0, sizeof(mat));
+    mat.flat = 1;
+    mat.c = c;
+
+    return add_surface(normal, add_material(&mat));
+}
+
+// What the resolve tasks write and read
+struct resolve {
+    screen s;
+    zbuffer zb;
+};
+
+static void resolve_rows(int index, void * arg) {
+    struct resolve * r = arg;
+    screen s = r -> s;
+    int yend = (index + 1) * RESOLVE_ROWS < YRES ? (index + 1) * RESOLVE_ROWS : YRES;
+    long shaded = 0;
+
+    for (int y = index * RESOLVE_ROWS; y < yend; y++) {
+        for (int x = 0; x < XRES; x++) {
+            int id = decode(gbuffer[y][x]);
+            if (!id) continue;
+
+            struct material * mat = &materials[surfaces[id].material];
+            if (mat -> flat) {
+                s[y][x] = mat -> c;
+                continue;
+            }
+
+            // lighting_color normalizes the normal in place
+            double normal[3];
+            memcpy(normal, surfaces[id].normal, sizeof(normal));
+
+            // with -m the lights the pixel is hidden from are left out
+            int hidden = 0;
+            if (opts.shadows) {
+                double p[3];
+
+                camera_unproject(x, YRES - 1 - y, r -> zb[y][x], p);
+                hidden = shadow_mask(p[0], p[1], p[2], normal);
+            }
+
+            s[y][x] = lighting_color_mask(prepared[surfaces[id].material], normal, hidden);
+            shaded++;
+        }
+    }
+    __atomic_fetch_add(&gbuffer_stats.pixels_shaded, shaded, __ATOMIC_RELAXED);
+}
+
+/*======== void gbuffer_resolve() ==========
+Inputs:   screen s
+          zbuffer zb
+Lights every covered pixel of the G-buffer into s, row
+strips in parallel on the worker pool. Empty pixels keep
+whatever s had. The lights of every material are looked up
+front, so the workers only read them. With -m the shadow
+maps have to be up to date.
+====================*/
+void gbuffer_resolve(screen s, zbuffer zb) {
+    struct resolve r = {s, zb};
+
+    if (nmaterials > prepared_size) {
+        prepared_size = materials_size;
+        prepared = realloc(prepared, prepared_size * sizeof(struct lighting *));
+    }
+    for (int i = 0; i < nmaterials; i++) {
+        struct material * mat = &materials[i];
+
+        if (!mat -> flat)
+            prepared[i] = lighting_get(mat -> view, mat -> lights, mat -> ambient, mat -> reflect);
+    }
+
+    pool_run((YRES + RESOLVE_ROWS - 1) / RESOLVE_ROWS, resolve_rows, &r);
+}
+
+void gbuffer_print_stats() {
+    printf("Deferred: %ld surfaces, %ld pixels shaded\n",
+           gbuffer_stats.surfaces, gbuffer_stats.pixels_shaded);
+}
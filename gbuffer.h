@@ -0,0 +1,25 @@
+#ifndef GBUFFER_H
+#define GBUFFER_H
+
+#include "ml6.h"
+#include "symtab.h"
+#include "gmath.h"
+
+struct gbuffer_stats {
+    long surfaces;
+    long pixels_shaded;
+};
+
+extern struct gbuffer_stats gbuffer_stats;
+
+// Surface ids drawn by the raster pass, in place of colors
+extern screen gbuffer;
+
+void gbuffer_clear();
+color gbuffer_surface(double * normal, double * view, color ambient,
+                      struct lights * lights, struct constants * reflect);
+color gbuffer_flat(color c);
+void gbuffer_resolve(screen s, zbuffer zb);
+void gbuffer_print_stats();
+
+#endif
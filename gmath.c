@@ -1,6 +1,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <math.h>
+#include <emmintrin.h>
 
 #include "gmath.h"
 #include "matrix.h"
@@ -10,42 +11,296 @@
 /*============================================
   IMPORANT NOTE
   Ambient light is represeneted by a color value
-  Point light sources are 2D arrays of doubles.
-       - The fist index (LOCATION) represents the vector to the light.
-       - The second index (COLOR) represents the color.
+  Point light sources are kept together in a struct lights,
+  one array per coordinate of the vector to each light and
+  per channel of its color.
   Reflection constants (ka, kd, ks) are represened as arrays of
   doubles (red, green, blue)
   ============================================*/
 
+// pow(i / SPECULAR_TABLE, SPECULAR_EXP), with one extra entry. Filled
+// by the first lighting_init, which runs before any pool workers read it
+static double spec_table[SPECULAR_TABLE + 2];
+static int spec_ready = 0;
+
+/*
+  A prepared lighting and what it was prepared from
+*/
+struct cached_lighting {
+	struct constants * reflect;
+	struct lights * lights;
+	color ambient;
+	double view[3];
+	struct lighting ls;
+};
+
+static struct cached_lighting ** cache = NULL;
+static int ncached = 0;
+static int cache_size = 0;
+
 // Lighting functions
-color get_lighting(double * normal, double * view, color ambient, double light[2][3], struct constants * reflect) {
-	color point;
-	point.red = light[COLOR][RED];
-	point.green = light[COLOR][GREEN];
-	point.blue = light[COLOR][BLUE];
+color get_lighting(double * normal, double * view, color ambient, struct lights * lights, struct constants * reflect) {
+	struct lighting ls;
+
+	lighting_init(&ls, view, lights, ambient, reflect);
+	return lighting_color(&ls, normal);
+}
+
+/*======== int add_light() ==========
+Inputs:   struct lights * lights
+          double * location
+          double * c
+Returns:  0 if lights is already full
+====================*/
+int add_light(struct lights * lights, double * location, double * c) {
+	int i = lights -> count;
+
+	if (i == MAX_LIGHTS) return 0;
+
+	lights -> x[i] = location[0];
+	lights -> y[i] = location[1];
+	lights -> z[i] = location[2];
+	lights -> r[i] = c[RED];
+	lights -> g[i] = c[GREEN];
+	lights -> b[i] = c[BLUE];
+	lights -> count++;
+	return 1;
+}
 
-	double lightspot[3];
-	lightspot[0] = light[LOCATION][0];
-	lightspot[1] = light[LOCATION][1];
-	lightspot[2] = light[LOCATION][2];
+/*======== void lighting_init() ==========
+Inputs:   struct lighting * ls
+          the other inputs of get_lighting
+Normalizes the view and light vectors and multiplies the
+light colors through the reflection constants, once for
+everything drawn with one material. A light whose diffuse
+plus specular can't reach a whole unit in any channel is
+left out: every one of its terms would truncate to 0. For
+the same reason each light gets the smallest reflection
+whose specular term can count, and anything outside that
+highlight skips the specular term. The first call also fills
+the specular power table, so workers only ever read it.
+====================*/
+void lighting_init(struct lighting * ls, double * view, struct lights * lights,
+                   color ambient, struct constants * reflect) {
+	if (!spec_ready) {
+		for (int k = 0; k < SPECULAR_TABLE + 2; k++)
+			spec_table[k] = pow((double) k / SPECULAR_TABLE, SPECULAR_EXP);
+		spec_ready = 1;
+	}
+
+	ls -> v[0] = view[0];
+	ls -> v[1] = view[1];
+	ls -> v[2] = view[2];
+	normalize(ls -> v);
+
+	// worked out in ints, since a color byte could overflow
+	ls -> a[RED] = ambient.red * reflect -> r[AMBIENT_R];
+	ls -> a[GREEN] = ambient.green * reflect -> g[AMBIENT_R];
+	ls -> a[BLUE] = ambient.blue * reflect -> b[AMBIENT_R];
+
+	ls -> count = 0;
+	for (int i = 0; i < lights -> count; i++) {
+		double l[3] = {lights -> x[i], lights -> y[i], lights -> z[i]};
+		int point[3] = {lights -> r[i], lights -> g[i], lights -> b[i]};
+		double kd[3], ks[3];
+		int n = ls -> count;
+
+		kd[RED] = point[RED] * reflect -> r[DIFFUSE_R];
+		kd[GREEN] = point[GREEN] * reflect -> g[DIFFUSE_R];
+		kd[BLUE] = point[BLUE] * reflect -> b[DIFFUSE_R];
+		ks[RED] = point[RED] * reflect -> r[SPECULAR_R];
+		ks[GREEN] = point[GREEN] * reflect -> g[SPECULAR_R];
+		ks[BLUE] = point[BLUE] * reflect -> b[SPECULAR_R];
+
+		if (kd[RED] + ks[RED] < LIGHT_THRESHOLD && kd[GREEN] + ks[GREEN] < LIGHT_THRESHOLD
+			&& kd[BLUE] + ks[BLUE] < LIGHT_THRESHOLD) continue;
+
+		normalize(l);
+		ls -> lx[n] = l[0];
+		ls -> ly[n] = l[1];
+		ls -> lz[n] = l[2];
+		ls -> id[n] = i;
+		for (int c = 0; c < 3; c++) {
+			ls -> kd[c][n] = kd[c];
+			ls -> ks[c][n] = ks[c];
+		}
+
+		// below this, ks * r^SPECULAR_EXP stays under 1 in every channel
+		double ksmax = fmax(ks[RED], fmax(ks[GREEN], ks[BLUE]));
+		ls -> smin[n] = ksmax < LIGHT_THRESHOLD ? 2 :
+			pow(LIGHT_THRESHOLD / ksmax, 1.0 / SPECULAR_EXP) * (1 - SPECULAR_MARGIN);
+		ls -> count++;
+	}
+
+	// the SSE2 loop goes two lights at a time
+	if (ls -> count % 2) {
+		int n = ls -> count;
+
+		ls -> lx[n] = ls -> ly[n] = 0;
+		ls -> lz[n] = 1;
+		ls -> id[n] = MAX_LIGHTS;
+	}
+}
+
+/*======== color lighting_color() ==========
+Inputs:   struct lighting * ls
+          double * normal
+Returns:  The color of a surface with the given normal,
+          which is normalized in place
+The per light vectors are worked out two lights at a time
+with SSE2 over the structure of arrays in ls, in the same
+order as the scalar math, so the result doesn't depend on
+it. Each term of each light truncates on its own and they
+are added up, which for a single light is exactly the
+original ambient + diffuse + specular.
+====================*/
+color lighting_color(struct lighting * ls, double * normal) {
+	return lighting_color_mask(ls, normal, 0);
+}
+
+/*======== color lighting_color_mask() ==========
+Inputs:   struct lighting * ls
+          double * normal
+          int hidden
+Returns:  lighting_color, leaving out every light whose bit
+          (by its index in the scene's lights) is set in hidden
+====================*/
+color lighting_color_mask(struct lighting * ls, double * normal, int hidden) {
+	double diffuse[MAX_LIGHTS + 1];
+	double specular[MAX_LIGHTS + 1];
 
 	normalize(normal);
-	normalize(lightspot);
 
-	color a = calculate_ambient(ambient, reflect);
-	color d = calculate_diffuse(point, reflect, normal, lightspot);
-	color s = calculate_specular(point, reflect, view, normal, lightspot);
+	double costheta = dot_product(normal, ls -> v);
+	if (costheta < 0) costheta = 0;
 
-	color i;
+	__m128d nx = _mm_set1_pd(normal[0]);
+	__m128d ny = _mm_set1_pd(normal[1]);
+	__m128d nz = _mm_set1_pd(normal[2]);
+	__m128d vx = _mm_set1_pd(ls -> v[0]);
+	__m128d vy = _mm_set1_pd(ls -> v[1]);
+	__m128d vz = _mm_set1_pd(ls -> v[2]);
+	__m128d tx = _mm_set1_pd(2 * normal[0] * costheta);
+	__m128d ty = _mm_set1_pd(2 * normal[1] * costheta);
+	__m128d tz = _mm_set1_pd(2 * normal[2] * costheta);
+	__m128d zero = _mm_setzero_pd();
+
+	for (int i = 0; i < ls -> count; i += 2) {
+		__m128d lx = _mm_loadu_pd(ls -> lx + i);
+		__m128d ly = _mm_loadu_pd(ls -> ly + i);
+		__m128d lz = _mm_loadu_pd(ls -> lz + i);
+
+		__m128d d = _mm_add_pd(_mm_add_pd(_mm_mul_pd(nx, lx), _mm_mul_pd(ny, ly)),
+							   _mm_mul_pd(nz, lz));
+		_mm_storeu_pd(diffuse + i, _mm_max_pd(d, zero));
+
+		__m128d rx = _mm_sub_pd(tx, lx);
+		__m128d ry = _mm_sub_pd(ty, ly);
+		__m128d rz = _mm_sub_pd(tz, lz);
+		__m128d mag = _mm_sqrt_pd(_mm_add_pd(_mm_add_pd(_mm_mul_pd(rx, rx), _mm_mul_pd(ry, ry)),
+											 _mm_mul_pd(rz, rz)));
+		__m128d r = _mm_add_pd(_mm_add_pd(_mm_mul_pd(_mm_div_pd(rx, mag), vx),
+										  _mm_mul_pd(_mm_div_pd(ry, mag), vy)),
+							   _mm_mul_pd(_mm_div_pd(rz, mag), vz));
+		_mm_storeu_pd(specular + i, _mm_max_pd(r, zero));
+	}
+
+	int c[3] = {ls -> a[RED], ls -> a[GREEN], ls -> a[BLUE]};
 
-	i.red = a.red + d.red + s.red;
-	i.green = a.green + d.green + s.green;
-	i.blue = a.blue + d.blue + s.blue;
+	for (int i = 0; i < ls -> count; i++) {
+		if (hidden >> ls -> id[i] & 1) continue;
 
-	limit_color(&i);
+		for (int k = 0; k < 3; k++)
+			c[k] += (unsigned short) (ls -> kd[k][i] * diffuse[i]);
+
+		if (specular[i] >= ls -> smin[i]) specular_terms(ls, i, specular[i], c);
+	}
+
+	color i;
+
+	i.red = c[RED] > 255 ? 255 : c[RED];
+	i.green = c[GREEN] > 255 ? 255 : c[GREEN];
+	i.blue = c[BLUE] > 255 ? 255 : c[BLUE];
+	i.alpha = MAX_COLOR;
 	return i;
 }
 
+/*======== void specular_terms() ==========
+Inputs:   struct lighting * ls
+          int i
+          double r
+          int * c
+Adds the specular term of light i for a reflection of r to
+each channel of c, truncated like the other terms. The
+power comes from a table, interpolated; the interpolation is
+off by at most 1.5 / SPECULAR_TABLE^2, so unless the term is
+within SPECULAR_TOLERANCE of a whole number the truncation
+is the same as with pow, and pow is only called when it is.
+====================*/
+void specular_terms(struct lighting * ls, int i, double r, int * c) {
+	double t = r * SPECULAR_TABLE;
+	int k = t;
+	double p = k > SPECULAR_TABLE ? pow(r, SPECULAR_EXP) :
+		spec_table[k] + (t - k) * (spec_table[k + 1] - spec_table[k]);
+
+	for (int j = 0; j < 3; j++) {
+		double ks = ls -> ks[j][i];
+		double e = ks * SPECULAR_TOLERANCE;
+		int lo = ks * p - e;
+		int hi = ks * p + e;
+
+		c[j] += lo == hi ? lo : (unsigned short) (ks * pow(r, SPECULAR_EXP));
+	}
+}
+
+/*======== struct lighting * lighting_get() ==========
+Inputs:   the inputs of lighting_init
+Returns:  The lights prepared for this material, shared by
+          every draw with the same constants and lights
+          until the next lighting_clear
+Scripts use a handful of materials, so the cache is a list
+searched from the last one added.
+====================*/
+struct lighting * lighting_get(double * view, struct lights * lights, color ambient,
+                               struct constants * reflect) {
+	for (int i = ncached - 1; i >= 0; i--) {
+		struct cached_lighting * e = cache[i];
+
+		if (e -> reflect == reflect && e -> lights == lights
+			&& e -> ambient.red == ambient.red && e -> ambient.green == ambient.green
+			&& e -> ambient.blue == ambient.blue && e -> view[0] == view[0]
+			&& e -> view[1] == view[1] && e -> view[2] == view[2])
+			return &e -> ls;
+	}
+
+	// entries stay where they are, so pointers handed out stay good
+	if (ncached == cache_size) {
+		cache_size = cache_size ? cache_size * 2 : 16;
+		cache = realloc(cache, cache_size * sizeof(struct cached_lighting *));
+		for (int i = ncached; i < cache_size; i++)
+			cache[i] = malloc(sizeof(struct cached_lighting));
+	}
+
+	struct cached_lighting * e = cache[ncached++];
+	e -> reflect = reflect;
+	e -> lights = lights;
+	e -> ambient = ambient;
+	e -> view[0] = view[0];
+	e -> view[1] = view[1];
+	e -> view[2] = view[2];
+	lighting_init(&e -> ls, view, lights, ambient, reflect);
+
+	return &e -> ls;
+}
+
+/*======== void lighting_clear() ==========
+Forgets every prepared lighting, to go with clear_zbuffer,
+in case constants or lights changed between frames
+====================*/
+void lighting_clear() {
+	ncached = 0;
+}
+
 color calculate_ambient(color ambient, struct constants * reflect) {
 	color a;
 
@@ -56,6 +311,7 @@ color calculate_ambient(color ambient, struct constants * reflect) {
 	a.red = ambient.red * reflect_red;
 	a.green = ambient.green * reflect_green;
 	a.blue = ambient.blue * reflect_blue;
+	a.alpha = MAX_COLOR;
 
 	return a;
 }
@@ -73,6 +329,7 @@ color calculate_diffuse(color point, struct constants * reflect, double * normal
 	d.red = point.red * reflect_red * reflection;
 	d.green = point.green * reflect_green * reflection;
 	d.blue = point.blue * reflect_blue * reflection;
+	d.alpha = MAX_COLOR;
 
 	return d;
 }
@@ -103,6 +360,7 @@ color calculate_specular(color point, struct constants * reflect, double * view,
 	s.red = point.red * reflect_red * reflection;
 	s.green = point.green * reflect_green * reflection;
 	s.blue = point.blue * reflect_blue * reflection;
+	s.alpha = MAX_COLOR;
 
 	return s;
 }
@@ -139,10 +397,9 @@ double dot_product(double * a, double * b) {
 }
 
 // Calculate the surface normal for the triangle whose first
-// point is located at index i in polygons
-double * calculate_normal(struct matrix * polygons, int i) {
+// point is located at index i in polygons, into norm
+void calculate_normal(double * norm, struct matrix * polygons, int i) {
 	double ** matrix = polygons -> m;
-	double * norm = malloc(3 * sizeof(double));
   	double a[3];
   	double b[3];
 
@@ -157,6 +414,4 @@ double * calculate_normal(struct matrix * polygons, int i) {
   	norm[0] = (a[1] * b[2]) - (a[2] * b[1]);
   	norm[1] = (a[2] * b[0]) - (a[0] * b[2]);
   	norm[2] = (a[0] * b[1]) - (a[1] * b[0]);
-
-  	return norm;
 }
\ No newline at end of file
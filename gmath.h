@@ -13,8 +13,54 @@
 #define BLUE 2
 #define SPECULAR_EXP 4
 
+#define MAX_LIGHTS 16
+// Lights that can't add this much to a channel are skipped
+#define LIGHT_THRESHOLD 1.0
+// Relative slack on the smallest specular reflection that counts
+#define SPECULAR_MARGIN 1e-6
+// Steps in the specular power table, and how close to a whole
+// number a term from the table has to be to check it with pow
+#define SPECULAR_TABLE 1024
+#define SPECULAR_TOLERANCE 1e-5
+
+/*
+  The point lights of a scene, as structure of arrays: the
+  vector to each light and its color
+*/
+struct lights {
+    int count;
+    double x[MAX_LIGHTS], y[MAX_LIGHTS], z[MAX_LIGHTS];
+    double r[MAX_LIGHTS], g[MAX_LIGHTS], b[MAX_LIGHTS];
+};
+
+/*
+  The lights of a scene prepared for one material: only the
+  ones that can change a color, normalized, with their colors
+  times the diffuse and specular constants. There is room for
+  a padding light past count.
+*/
+struct lighting {
+    int count;
+    double lx[MAX_LIGHTS + 1], ly[MAX_LIGHTS + 1], lz[MAX_LIGHTS + 1];
+    double kd[3][MAX_LIGHTS + 1];
+    double ks[3][MAX_LIGHTS + 1];
+    double smin[MAX_LIGHTS + 1];    // specular cutoff, see lighting_init
+    int id[MAX_LIGHTS + 1];         // index in the scene's lights
+    double v[3];
+    int a[3];
+};
+
 // Lighting functions
-color get_lighting(double * normal, double * view, color ambient, double light[2][3], struct constants * reflect);
+color get_lighting(double * normal, double * view, color ambient, struct lights * lights, struct constants * reflect);
+int add_light(struct lights * lights, double * location, double * c);
+void lighting_init(struct lighting * ls, double * view, struct lights * lights,
+                   color ambient, struct constants * reflect);
+color lighting_color(struct lighting * ls, double * normal);
+color lighting_color_mask(struct lighting * ls, double * normal, int hidden);
+void specular_terms(struct lighting * ls, int i, double r, int * c);
+struct lighting * lighting_get(double * view, struct lights * lights, color ambient,
+                               struct constants * reflect);
+void lighting_clear();
 color calculate_ambient(color ambient, struct constants * reflect);
 color calculate_diffuse(color point, struct constants * reflect, double * normal, double * light);
 color calculate_specular(color point, struct constants * reflect, double * view, double * normal, double * light);
@@ -23,6 +69,6 @@ void limit_color(color * c);
 // Vector functions
 void normalize(double * vector);
 double dot_product(double * a, double * b);
-double * calculate_normal(struct matrix * polygons, int i);
+void calculate_normal(double * norm, struct matrix * polygons, int i);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,244 @@
+/*====================== gouraud.c ========================
+Gouraud shading.
+
+The polygon matrix repeats a vertex for every triangle that
+uses it, so setup_gouraud first finds the shared vertices by
+hashing positions, and lists the triangles around each one.
+A triangle's corner is shaded with the sum of the (area
+weighted) normals of the triangles around its vertex that
+are within the crease angle of its own, front facing or
+not, so silhouettes are smooth too. Faces are compared with
+each other rather than with an average, so a large face
+can't pull the normal far enough to smooth a box's edges,
+and hard edges stay hard whatever the faces' sizes.
+
+Only corners of triangles that survive culling are lit, with
+lighting_color. A vertex with no crease is lit once however
+many triangles share it; a corner next to a crease is lit
+on its own. gouraud_fill in shade.c interpolates the three
+colors. Phong shading uses the same corner normals.
+
+Positions are snapped to 1 / VERTEX_GRID of a pixel before
+hashing, so the seam of a sphere, where the first and last
+longitude only match up to rounding, still shares vertices.
+==================================================*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "ml6.h"
+#include "draw.h"
+#include "gmath.h"
+#include "matrix.h"
+#include "symtab.h"
+#include "config.h"
+#include "hiz.h"
+#include "setup.h"
+#include "shade.h"
+#include "camera.h"
+#include "gouraud.h"
+
+#define VERTEX_GRID 1024.0
+
+// Triangles more than 30 degrees apart aren't smoothed together
+#define CREASE_COS 0.866
+
+struct gouraud_stats gouraud_stats;
+
+static struct triangles tris;
+
+// The shared vertices of the current polygon matrix
+static long long * keys = NULL;     // snapped x, y, z
+static int * slots = NULL;          // hash table of vertex ids, -1 if empty
+static int nslots = 0;
+static color * colors = NULL;
+static char * lit = NULL;
+static int * vertex = NULL;         // vertex id of each column
+static int nvertices;
+static int size = 0;
+
+// The triangles around vertex v are around[first[v]] to around[first[v + 1] - 1]
+static int * first = NULL;
+static int * around = NULL;
+static double (* faces)[3] = NULL;  // normal of each triangle
+static double * face_mags = NULL;
+
+static void grow(int ncols) {
+    if (ncols <= size) return;
+
+    size = ncols;
+    keys = realloc(keys, 3 * size * sizeof(long long));
+    colors = realloc(colors, size * sizeof(color));
+    lit = realloc(lit, size);
+    vertex = realloc(vertex, size * sizeof(int));
+    first = realloc(first, (size + 1) * sizeof(int));
+    around = realloc(around, size * sizeof(int));
+    faces = realloc(faces, size * sizeof(*faces));
+    face_mags = realloc(face_mags, size * sizeof(double));
+
+    nslots = 1;
+    while (nslots < 2 * size) nslots *= 2;
+    slots = realloc(slots, nslots * sizeof(int));
+}
+
+/*======== int vertex_id() ==========
+Inputs:   double ** m
+          int col
+Returns:  The id of the shared vertex at column col, adding
+          it if it's new
+====================*/
+static int vertex_id(double ** m, int col) {
+    long long k[3];
+    unsigned long long h = 0;
+
+    for (int i = 0; i < 3; i++) {
+        k[i] = llround(m[i][col] * VERTEX_GRID);
+        h = (h ^ (unsigned long long) k[i]) * 0x100000001b3ULL;
+    }
+
+    for (int j = (h ^ (h >> 29)) & (nslots - 1); ; j = (j + 1) & (nslots - 1)) {
+        int v = slots[j];
+
+        if (v < 0) {
+            v = nvertices++;
+            memcpy(&keys[3 * v], k, sizeof(k));
+            lit[v] = 0;
+            slots[j] = v;
+            return v;
+        }
+        if (!memcmp(&keys[3 * v], k, sizeof(k))) return v;
+    }
+}
+
+/*======== struct triangles * smooth_triangles() ==========
+Inputs:   struct matrix * polygons
+Returns:  The front facing, unoccluded triangles of polygons,
+          with room for per vertex colors and normals
+Also finds the shared vertices and the triangles around
+them, for corner_normal. The result is reused by the next
+call.
+====================*/
+struct triangles * smooth_triangles(struct matrix * polygons) {
+    double ** m = polygons -> m;
+    int ntris = polygons -> lastcol / 3;
+
+    grow(polygons -> lastcol);
+    if (ntris > tris.size) {
+        tris.size = ntris;
+        tris.cols = realloc(tris.cols, tris.size * sizeof(int));
+        tris.vcolors = realloc(tris.vcolors, 3 * tris.size * sizeof(color));
+        tris.vnormals = realloc(tris.vnormals, 9 * tris.size * sizeof(double));
+    }
+    tris.count = 0;
+
+    nvertices = 0;
+    for (int j = 0; j < nslots; j++) slots[j] = -1;
+    for (int col = 0; col < 3 * ntris; col++) vertex[col] = vertex_id(m, col);
+
+    // count the corners at each vertex, then list their triangles
+    for (int v = 0; v <= nvertices; v++) first[v] = 0;
+    for (int col = 0; col < 3 * ntris; col++) first[vertex[col] + 1]++;
+    for (int v = 0; v < nvertices; v++) first[v + 1] += first[v];
+    for (int col = 0; col < 3 * ntris; col++) around[first[vertex[col]]++] = col / 3;
+    for (int v = nvertices; v > 0; v--) first[v] = first[v - 1];
+    first[0] = 0;
+
+    for (int col = 0; col < 3 * ntris; col += 3) {
+        double n[3];
+        double * f = faces[col / 3];
+
+        surface_normal(f, polygons, col);
+        face_mags[col / 3] = sqrt(f[0] * f[0] + f[1] * f[1] + f[2] * f[2]);
+        memcpy(n, f, sizeof(n));
+
+        // facing is decided on the screen, even in perspective
+        if (camera_normals(polygons)) calculate_normal(n, polygons, col);
+        if (n[2] <= 0) continue;
+        if (opts.hiz && hiz_triangle_occluded(polygons, col)) continue;
+        tris.cols[tris.count++] = col;
+    }
+
+    return &tris;
+}
+
+/*======== int corner_normal() ==========
+Inputs:   struct matrix * polygons
+          int col
+          int i
+          double * n
+Returns:  The shared vertex at corner i of the triangle at
+          col, or -1 if the corner is next to a hard edge
+Sets n to the (unnormalized) normal to shade the corner
+with: the sum of the normals of the triangles around the
+vertex within the crease angle of this one. Only corners
+that smooth every triangle around their vertex share it,
+so only those return the vertex.
+====================*/
+int corner_normal(struct matrix * polygons, int col, int i, double * n) {
+    int v = vertex[col + i];
+    double * f = faces[col / 3];
+    double fmag = face_mags[col / 3];
+    int smooth = 1;
+
+    n[0] = n[1] = n[2] = 0;
+    for (int k = first[v]; k < first[v + 1]; k++) {
+        double * g = faces[around[k]];
+
+        if (f[0] * g[0] + f[1] * g[1] + f[2] * g[2] < CREASE_COS * fmag * face_mags[around[k]]) {
+            smooth = 0;
+            continue;
+        }
+        n[0] += g[0];
+        n[1] += g[1];
+        n[2] += g[2];
+    }
+
+    return smooth ? v : -1;
+}
+
+/*======== struct triangles * setup_gouraud() ==========
+Inputs:   struct matrix * polygons
+          the lighting inputs of draw_polygons
+Returns:  The front facing, unoccluded triangles of polygons
+          with a lit color for each vertex. The result is
+          reused by the next call.
+====================*/
+struct triangles * setup_gouraud( struct matrix * polygons,
+                                  double * view, struct lights * lights, color ambient,
+                                  struct constants * reflect) {
+    struct lighting * ls = lighting_get(view, lights, ambient, reflect);
+
+    smooth_triangles(polygons);
+
+    for (int t = 0; t < tris.count; t++) {
+        for (int i = 0; i < 3; i++) {
+            double n[3];
+            int v = corner_normal(polygons, tris.cols[t], i, n);
+
+            if (v < 0) {
+                tris.vcolors[3 * t + i] = lighting_color(ls, n);
+                gouraud_stats.lit++;
+                continue;
+            }
+
+            if (!lit[v]) {
+                // a vertex whose triangles cancel out, like a degenerate pole
+                if (n[0] == 0 && n[1] == 0 && n[2] == 0) n[2] = 1;
+                colors[v] = lighting_color(ls, n);
+                lit[v] = 1;
+                gouraud_stats.lit++;
+            }
+            tris.vcolors[3 * t + i] = colors[v];
+        }
+    }
+    gouraud_stats.vertices += 3 * tris.count;
+
+    return &tris;
+}
+
+void gouraud_print_stats() {
+    printf("Gouraud: lit %ld vertices for %ld triangle corners\n",
+           gouraud_stats.lit, gouraud_stats.vertices);
+}
@@ -0,0 +1,23 @@
+#ifndef GOURAUD_H
+#define GOURAUD_H
+
+#include "matrix.h"
+#include "ml6.h"
+#include "symtab.h"
+#include "setup.h"
+
+struct gouraud_stats {
+    long vertices;
+    long lit;
+};
+
+extern struct gouraud_stats gouraud_stats;
+
+struct triangles * smooth_triangles(struct matrix * polygons);
+int corner_normal(struct matrix * polygons, int col, int i, double * n);
+struct triangles * setup_gouraud( struct matrix * polygons,
+                                  double * view, struct lights * lights, color ambient,
+                                  struct constants * reflect);
+void gouraud_print_stats();
+
+#endif
@@ -0,0 +1,281 @@
+/*====================== hiz.c ========================
+Hierarchical z-buffer.
+
+A pyramid of coarse depth tiles kept next to the zbuffer.
+Level 0 tiles cover HIZ_TILE x HIZ_TILE pixels and each
+level above halves the resolution. Every tile stores the
+farthest depth written in it. Since a pixel is only drawn
+when its z is greater than the zbuffer, the farthest depth
+is the only bound occlusion needs: anything whose nearest
+point is behind the farthest depth of every tile it
+touches can't change a single pixel.
+
+Writers mark the area they touched as dirty, and
+hiz_update recomputes the dirty tiles bottom up. Between
+updates the pyramid is stale, but depths only grow, so a
+stale tile is behind the real one and the test stays
+conservative. draw_polygons updates once per object, so
+triangles of the same object are tested against what was
+drawn before it.
+
+All coordinates here are raster coordinates, before the
+y flip in plot.
+==================================================*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <math.h>
+
+#include "ml6.h"
+#include "matrix.h"
+#include "camera.h"
+#include "hiz.h"
+
+#define HIZ_LEVELS 16
+
+// Most tiles looked at when refining an occlusion test
+#define HIZ_MAX_TILES 64
+
+// Slack for the rounding in the fills, relative to |z|
+#define HIZ_EPSILON 1e-6
+
+struct hiz_stats hiz_stats;
+
+static int nlevels = 0;
+static int width[HIZ_LEVELS];
+static int height[HIZ_LEVELS];
+static double * farthest[HIZ_LEVELS];
+static char * dirty[HIZ_LEVELS];
+static int any_dirty;
+
+/*======== void hiz_init() ==========
+Allocates the levels, down to a single tile
+====================*/
+static void hiz_init() {
+    int w = (XRES + HIZ_TILE - 1) / HIZ_TILE;
+    int h = (YRES + HIZ_TILE - 1) / HIZ_TILE;
+
+    while (nlevels < HIZ_LEVELS) {
+        width[nlevels] = w;
+        height[nlevels] = h;
+        farthest[nlevels] = malloc(w * h * sizeof(double));
+        dirty[nlevels] = calloc(w * h, 1);
+        nlevels++;
+
+        if (w == 1 && h == 1) break;
+        w = (w + 1) / 2;
+        h = (h + 1) / 2;
+    }
+}
+
+/*======== void hiz_clear() ==========
+Resets the pyramid to match a cleared zbuffer
+====================*/
+void hiz_clear() {
+    if (nlevels == 0) hiz_init();
+
+    for (int l = 0; l < nlevels; l++) {
+        for (int i = 0; i < width[l] * height[l]; i++) {
+            farthest[l][i] = LONG_MIN;
+            dirty[l][i] = 0;
+        }
+    }
+    any_dirty = 0;
+}
+
+/*======== void hiz_dirty() ==========
+Inputs:   double xmin, ymin, xmax, ymax
+Marks every tile that overlaps the box, and the tiles
+above them, as needing an update
+====================*/
+void hiz_dirty(double xmin, double ymin, double xmax, double ymax) {
+    int x0 = floor(xmin) - 1;
+    int y0 = floor(ymin) - 1;
+    int x1 = ceil(xmax) + 1;
+    int y1 = ceil(ymax) + 1;
+
+    if (x0 < 0) x0 = 0;
+    if (y0 < 0) y0 = 0;
+    if (x1 > XRES - 1) x1 = XRES - 1;
+    if (y1 > YRES - 1) y1 = YRES - 1;
+    if (x0 > x1 || y0 > y1) return;
+
+    x0 /= HIZ_TILE;
+    y0 /= HIZ_TILE;
+    x1 /= HIZ_TILE;
+    y1 /= HIZ_TILE;
+
+    for (int l = 0; l < nlevels; l++) {
+        for (int j = y0 >> l; j <= y1 >> l; j++)
+            for (int i = x0 >> l; i <= x1 >> l; i++)
+                dirty[l][j * width[l] + i] = 1;
+    }
+    any_dirty = 1;
+}
+
+/*======== void hiz_update() ==========
+Inputs:   zbuffer zb
+Recomputes the dirty tiles from zb, bottom up
+====================*/
+void hiz_update(zbuffer zb) {
+    if (!any_dirty) return;
+
+    for (int j = 0; j < height[0]; j++) {
+        for (int i = 0; i < width[0]; i++) {
+            if (!dirty[0][j * width[0] + i]) continue;
+
+            int xend = (i + 1) * HIZ_TILE < XRES ? (i + 1) * HIZ_TILE : XRES;
+            int yend = (j + 1) * HIZ_TILE < YRES ? (j + 1) * HIZ_TILE : YRES;
+            double far = zb[YRES - 1 - j * HIZ_TILE][i * HIZ_TILE];
+
+            for (int y = j * HIZ_TILE; y < yend; y++)
+                for (int x = i * HIZ_TILE; x < xend; x++)
+                    if (zb[YRES - 1 - y][x] < far) far = zb[YRES - 1 - y][x];
+
+            farthest[0][j * width[0] + i] = far;
+            dirty[0][j * width[0] + i] = 0;
+        }
+    }
+
+    for (int l = 1; l < nlevels; l++) {
+        int cw = width[l - 1];
+        int ch = height[l - 1];
+
+        for (int j = 0; j < height[l]; j++) {
+            for (int i = 0; i < width[l]; i++) {
+                if (!dirty[l][j * width[l] + i]) continue;
+
+                double far = farthest[l - 1][2 * j * cw + 2 * i];
+                for (int cj = 2 * j; cj < 2 * j + 2 && cj < ch; cj++)
+                    for (int ci = 2 * i; ci < 2 * i + 2 && ci < cw; ci++)
+                        far = fmin(far, farthest[l - 1][cj * cw + ci]);
+
+                farthest[l][j * width[l] + i] = far;
+                dirty[l][j * width[l] + i] = 0;
+            }
+        }
+    }
+    any_dirty = 0;
+}
+
+/*======== int level_occluded() ==========
+Inputs:   int l
+          int x0, y0, x1, y1
+          double z
+Returns:  1 if every level l tile covering level 0 tiles
+          x0 to x1, y0 to y1 is farther than z
+====================*/
+static int level_occluded(int l, int x0, int y0, int x1, int y1, double z) {
+    for (int j = y0 >> l; j <= y1 >> l; j++)
+        for (int i = x0 >> l; i <= x1 >> l; i++)
+            if (farthest[l][j * width[l] + i] < z) return 0;
+    return 1;
+}
+
+/*======== int hiz_occluded() ==========
+Inputs:   double xmin, ymin, xmax, ymax
+          double zmax
+Returns:  1 if nothing in the box with depth at most zmax
+          can pass the depth test
+Starts at the coarsest level where the box covers at
+most 2x2 tiles, and refines while the box covers no more
+than HIZ_MAX_TILES tiles, since finer tiles hug the box
+tighter. A box that is entirely off screen is occluded.
+====================*/
+int hiz_occluded(double xmin, double ymin, double xmax, double ymax, double zmax) {
+    int x0 = floor(xmin);
+    int y0 = floor(ymin);
+    int x1 = ceil(xmax);
+    int y1 = ceil(ymax);
+
+    if (x0 < 0) x0 = 0;
+    if (y0 < 0) y0 = 0;
+    if (x1 > XRES - 1) x1 = XRES - 1;
+    if (y1 > YRES - 1) y1 = YRES - 1;
+    if (x0 > x1 || y0 > y1) return 1;
+
+    x0 /= HIZ_TILE;
+    y0 /= HIZ_TILE;
+    x1 /= HIZ_TILE;
+    y1 /= HIZ_TILE;
+
+    double z = zmax + HIZ_EPSILON * (1 + fabs(zmax));
+
+    int l = 0;
+    while ((x1 >> l) - (x0 >> l) > 1 || (y1 >> l) - (y0 >> l) > 1) l++;
+
+    for (; l >= 0; l--) {
+        int tiles = ((x1 >> l) - (x0 >> l) + 1) * ((y1 >> l) - (y0 >> l) + 1);
+
+        if (tiles > HIZ_MAX_TILES) break;
+        if (level_occluded(l, x0, y0, x1, y1, z)) return 1;
+    }
+    return 0;
+}
+
+/*======== int hiz_triangle_occluded() ==========
+Inputs:   struct matrix * polygons
+          int col
+Returns:  1 if the triangle at col can be skipped
+====================*/
+int hiz_triangle_occluded(struct matrix * polygons, int col) {
+    double ** m = polygons -> m;
+    double xmin = fmin(m[0][col], fmin(m[0][col + 1], m[0][col + 2]));
+    double xmax = fmax(m[0][col], fmax(m[0][col + 1], m[0][col + 2]));
+    double ymin = fmin(m[1][col], fmin(m[1][col + 1], m[1][col + 2]));
+    double ymax = fmax(m[1][col], fmax(m[1][col + 1], m[1][col + 2]));
+    double zmax = fmax(m[2][col], fmax(m[2][col + 1], m[2][col + 2]));
+
+    hiz_stats.tris_tested++;
+    if (hiz_occluded(xmin, ymin, xmax, ymax, zmax)) {
+        hiz_stats.tris_rejected++;
+        return 1;
+    }
+    return 0;
+}
+
+/*======== void hiz_dirty_triangle() ==========
+Inputs:   struct matrix * polygons
+          int col
+Marks the bounding box of the triangle at col as dirty
+====================*/
+void hiz_dirty_triangle(struct matrix * polygons, int col) {
+    double ** m = polygons -> m;
+
+    hiz_dirty(fmin(m[0][col], fmin(m[0][col + 1], m[0][col + 2])),
+              fmin(m[1][col], fmin(m[1][col + 1], m[1][col + 2])),
+              fmax(m[0][col], fmax(m[0][col + 1], m[0][col + 2])),
+              fmax(m[1][col], fmax(m[1][col + 1], m[1][col + 2])));
+}
+
+/*======== int hiz_object_occluded() ==========
+Inputs:   zbuffer zb
+          struct matrix * transform
+          double * lo
+          double * hi
+Returns:  1 if the object bounded by the box lo to hi
+          (before transform) can be skipped entirely
+The 8 corners are transformed to get the screen bounds,
+so this runs before the object is even generated. An object
+reaching behind the camera has no bounds and isn't tested.
+====================*/
+int hiz_object_occluded(zbuffer zb, struct matrix * transform, double * lo, double * hi) {
+    double bmin[3], bmax[3];
+
+    if (!camera_bounds(transform, lo, hi, bmin, bmax)) return 0;
+
+    hiz_update(zb);
+    hiz_stats.objects_tested++;
+    if (hiz_occluded(bmin[0], bmin[1], bmax[0], bmax[1], bmax[2])) {
+        hiz_stats.objects_rejected++;
+        return 1;
+    }
+    return 0;
+}
+
+void hiz_print_stats() {
+    printf("HiZ: rejected %ld of %ld triangles, %ld of %ld objects\n",
+           hiz_stats.tris_rejected, hiz_stats.tris_tested,
+           hiz_stats.objects_rejected, hiz_stats.objects_tested);
+}
@@ -0,0 +1,28 @@
+#ifndef HIZ_H
+#define HIZ_H
+
+#include "matrix.h"
+#include "ml6.h"
+
+// Pixels per side of a level 0 tile, doubles every level
+#define HIZ_TILE 8
+
+struct hiz_stats {
+    long tris_tested;
+    long tris_rejected;
+    long objects_tested;
+    long objects_rejected;
+};
+
+extern struct hiz_stats hiz_stats;
+
+void hiz_clear();
+void hiz_dirty(double xmin, double ymin, double xmax, double ymax);
+void hiz_update(zbuffer zb);
+int hiz_occluded(double xmin, double ymin, double xmax, double ymax, double zmax);
+int hiz_triangle_occluded(struct matrix * polygons, int col);
+void hiz_dirty_triangle(struct matrix * polygons, int col);
+int hiz_object_occluded(zbuffer zb, struct matrix * transform, double * lo, double * hi);
+void hiz_print_stats();
+
+#endif
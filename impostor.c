@@ -0,0 +1,342 @@
+/*====================== impostor.c ========================
+Analytic spheres and tori.
+
+Instead of tessellating, every pixel inside the screen
+bounds of the shape shoots a ray straight into the screen
+and intersects the untransformed shape. The projection is
+orthographic, so the point on the ray through pixel (x, y)
+at depth z is just (x, y, z), and the ray in object space
+is the inverse of the current stack matrix applied to it.
+The nearest hit gives the exact depth, which goes through
+the same zbuffer test as the triangle fills so analytic
+and tessellated objects composite, and the exact normal,
+which is lit per pixel.
+
+Pixels are sampled at integer coordinates, the same spots
+the scanline fill covers.
+==================================================*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "ml6.h"
+#include "draw.h"
+#include "gmath.h"
+#include "matrix.h"
+#include "symtab.h"
+#include "pool.h"
+#include "config.h"
+#include "hiz.h"
+#include "gbuffer.h"
+#include "aa.h"
+#include "impostor.h"
+
+#define SPHERE 0
+#define TORUS 1
+
+// Torus root search steps a quarter of the tube radius, then
+// bisects down to this much depth
+#define TORUS_STEPS_PER_RADIUS 4
+#define TORUS_TOLERANCE 1e-6
+
+struct impostor {
+    int type;
+    double c[3];
+    double r;           // sphere radius or torus tube radius
+    double ring;        // torus ring radius
+
+    double inv[3][3];   // inverse of the linear part of the transform
+    double move[3];     // translation part of the transform
+    double dir[3];      // the view ray in object space, per unit of z
+    double zmin, zmax;
+    double bmin[2], bmax[2];    // screen bounds
+    double dx, dy;      // where in the pixel to sample
+    int x0, y0, x1, y1; // pixels covered, inclusive
+
+    screen s;
+    zbuffer zb;
+    double * view;
+    struct lights * lights;
+    color ambient;
+    struct constants * reflect;
+    struct lighting * ls;
+};
+
+/*======== int impostor_setup() ==========
+Inputs:   struct impostor * im
+          struct matrix * transform
+          double * lo
+          double * hi
+Returns:  0 if the transform is degenerate
+Inverts the transform and finds the screen bounds of the
+box lo to hi under it
+====================*/
+static int impostor_setup(struct impostor * im, struct matrix * transform,
+                          double * lo, double * hi) {
+    double ** t = transform -> m;
+    double det = t[0][0] * (t[1][1] * t[2][2] - t[1][2] * t[2][1])
+               - t[0][1] * (t[1][0] * t[2][2] - t[1][2] * t[2][0])
+               + t[0][2] * (t[1][0] * t[2][1] - t[1][1] * t[2][0]);
+
+    if (fabs(det) < 1e-12) return 0;
+
+    for (int r = 0; r < 3; r++) {
+        for (int c = 0; c < 3; c++) {
+            // cofactor of t[c][r], transposed
+            int r0 = (c + 1) % 3, r1 = (c + 2) % 3;
+            int c0 = (r + 1) % 3, c1 = (r + 2) % 3;
+            im -> inv[r][c] = (t[r0][c0] * t[r1][c1] - t[r0][c1] * t[r1][c0]) / det;
+        }
+        im -> move[r] = t[r][3];
+    }
+    for (int r = 0; r < 3; r++) im -> dir[r] = im -> inv[r][2];
+
+    double bmin[3], bmax[3];
+    transform_bounds(transform, lo, hi, bmin, bmax);
+
+    for (int r = 0; r < 2; r++) {
+        im -> bmin[r] = bmin[r];
+        im -> bmax[r] = bmax[r];
+    }
+    im -> zmin = bmin[2];
+    im -> zmax = bmax[2];
+    return 1;
+}
+
+/*======== int impostor_pixels() ==========
+Inputs:   struct impostor * im
+          double dx, dy
+Returns:  0 if the shape is entirely off screen
+Finds the pixels whose sample at dx, dy in the pixel can
+hit the shape
+====================*/
+static int impostor_pixels(struct impostor * im, double dx, double dy) {
+    im -> dx = dx;
+    im -> dy = dy;
+    im -> x0 = ceil(im -> bmin[0] - dx);
+    im -> y0 = ceil(im -> bmin[1] - dy);
+    im -> x1 = floor(im -> bmax[0] - dx);
+    im -> y1 = floor(im -> bmax[1] - dy);
+
+    if (im -> x0 < 0) im -> x0 = 0;
+    if (im -> y0 < 0) im -> y0 = 0;
+    if (im -> x1 > XRES - 1) im -> x1 = XRES - 1;
+    if (im -> y1 > YRES - 1) im -> y1 = YRES - 1;
+
+    return im -> x0 <= im -> x1 && im -> y0 <= im -> y1;
+}
+
+/*======== int hit_sphere() ==========
+Inputs:   struct impostor * im
+          double * o
+          double * z
+          double * n
+Returns:  1 if the ray from object space point o along dir
+          hits, with the nearest depth in z and the object
+          space normal in n
+====================*/
+static int hit_sphere(struct impostor * im, double * o, double * z, double * n) {
+    double * d = im -> dir;
+    double a = dot_product(d, d);
+    double b = 2 * dot_product(o, d);
+    double c = dot_product(o, o) - im -> r * im -> r;
+    double disc = b * b - 4 * a * c;
+
+    if (disc < 0) return 0;
+
+    // the larger root is closer to the viewer
+    *z = (-b + sqrt(disc)) / (2 * a);
+    for (int i = 0; i < 3; i++) n[i] = o[i] + *z * d[i];
+    return 1;
+}
+
+static double torus_f(struct impostor * im, double * o, double t) {
+    double * d = im -> dir;
+    double q[3] = {o[0] + t * d[0], o[1] + t * d[1], o[2] + t * d[2]};
+    double g = dot_product(q, q) + im -> ring * im -> ring - im -> r * im -> r;
+
+    return g * g - 4 * im -> ring * im -> ring * (q[0] * q[0] + q[2] * q[2]);
+}
+
+/*======== int hit_torus() ==========
+Same as hit_sphere, for a torus around the y axis.
+f is a quartic in the depth that is positive outside the
+tube, so the nearest hit is the first sign change walking
+back through the bounding sphere, refined by bisection.
+The step is small enough that only grazing hits near the
+silhouette can be skipped over.
+====================*/
+static int hit_torus(struct impostor * im, double * o, double * z, double * n) {
+    double * d = im -> dir;
+    double a = dot_product(d, d);
+    double b = 2 * dot_product(o, d);
+    double outer = fabs(im -> ring) + fabs(im -> r);
+    double disc = b * b - 4 * a * (dot_product(o, o) - outer * outer);
+
+    if (disc < 0) return 0;
+
+    double step = fabs(im -> r) / TORUS_STEPS_PER_RADIUS / sqrt(a);
+    double far = (-b - sqrt(disc)) / (2 * a);
+    double hi = (-b + sqrt(disc)) / (2 * a);
+    double lo;
+
+    for (;;) {
+        lo = hi - step;
+        if (torus_f(im, o, lo) <= 0) break;
+        if (lo < far) return 0;
+        hi = lo;
+    }
+
+    while (hi - lo > TORUS_TOLERANCE) {
+        double mid = (lo + hi) / 2;
+
+        if (torus_f(im, o, mid) <= 0) lo = mid;
+        else hi = mid;
+    }
+
+    *z = lo;
+
+    double q[3] = {o[0] + lo * d[0], o[1] + lo * d[1], o[2] + lo * d[2]};
+    double g = dot_product(q, q) + im -> ring * im -> ring - im -> r * im -> r;
+    double k = 2 * im -> ring * im -> ring;
+
+    n[0] = g * q[0] - k * q[0];
+    n[1] = g * q[1];
+    n[2] = g * q[2] - k * q[2];
+    return 1;
+}
+
+static void draw_rows(int index, void * arg) {
+    struct impostor * im = arg;
+    int ystart = im -> y0 + index * IMPOSTOR_ROWS;
+    int yend = ystart + IMPOSTOR_ROWS - 1 < im -> y1 ? ystart + IMPOSTOR_ROWS - 1 : im -> y1;
+
+    for (int y = ystart; y <= yend; y++) {
+        int newy = YRES - 1 - y;
+
+        for (int x = im -> x0; x <= im -> x1; x++) {
+            double p[3] = {x + im -> dx - im -> move[0], y + im -> dy - im -> move[1], -im -> move[2]};
+            double o[3], z, n[3];
+
+            // ray origin at screen depth 0, relative to the center
+            for (int r = 0; r < 3; r++)
+                o[r] = dot_product(im -> inv[r], p) - im -> c[r];
+
+            int hit = im -> type == SPHERE ? hit_sphere(im, o, &z, n) : hit_torus(im, o, &z, n);
+            if (!hit || (float) z <= im -> zb[newy][x]) continue;
+
+            // normals go to screen space by the inverse transpose
+            double normal[3];
+            for (int r = 0; r < 3; r++)
+                normal[r] = im -> inv[0][r] * n[0] + im -> inv[1][r] * n[1] + im -> inv[2][r] * n[2];
+
+            im -> zb[newy][x] = z;
+            if (opts.deferred)
+                gbuffer[newy][x] = gbuffer_surface(normal, im -> view, im -> ambient, im -> lights, im -> reflect);
+            else
+                im -> s[newy][x] = lighting_color(im -> ls, normal);
+        }
+    }
+}
+
+/*======== void draw_impostor() ==========
+Inputs:   struct impostor * im
+Runs the rows of im in bands on the worker pool, once per
+sample plane with -a. Deferred mode registers surfaces as
+it goes, which isn't thread safe, so it stays on this
+thread.
+====================*/
+static void draw_impostor(struct impostor * im) {
+    if (!opts.deferred) im -> ls = lighting_get(im -> view, im -> lights, im -> ambient, im -> reflect);
+
+    for (int k = 0; k < aa_count(); k++) {
+        double dx = 0, dy = 0;
+
+        if (opts.aa > 1) {
+            aa_offset(k, &dx, &dy);
+            im -> s = *aa_screen(k);
+            im -> zb = *aa_zbuffer(k);
+        }
+        if (!impostor_pixels(im, dx, dy)) continue;
+
+        int bands = (im -> y1 - im -> y0) / IMPOSTOR_ROWS + 1;
+
+        if (opts.deferred) {
+            for (int i = 0; i < bands; i++) draw_rows(i, im);
+        }
+        else pool_run(bands, draw_rows, im);
+
+        if (opts.hiz) hiz_dirty(im -> x0, im -> y0, im -> x1, im -> y1);
+    }
+}
+
+/*======== void draw_sphere_impostor() ==========
+Inputs:   struct matrix * transform
+          double cx, cy, cz
+          double r
+          the rest as draw_polygons
+Returns:
+Draws the sphere add_sphere would make, transformed by
+transform, without tessellating it
+====================*/
+void draw_sphere_impostor( struct matrix * transform,
+                           double cx, double cy, double cz, double r,
+                           screen s, zbuffer zb,
+                           double * view, struct lights * lights, color ambient,
+                           struct constants * reflect) {
+    struct impostor im;
+    double lo[3], hi[3];
+
+    sphere_bounds(cx, cy, cz, r, lo, hi);
+    if (!impostor_setup(&im, transform, lo, hi)) return;
+
+    im.type = SPHERE;
+    im.c[0] = cx;
+    im.c[1] = cy;
+    im.c[2] = cz;
+    im.r = r;
+    im.s = s;
+    im.zb = zb;
+    im.view = view;
+    im.lights = lights;
+    im.ambient = ambient;
+    im.reflect = reflect;
+    draw_impostor(&im);
+}
+
+/*======== void draw_torus_impostor() ==========
+Inputs:   struct matrix * transform
+          double cx, cy, cz
+          double r1 (tube radius), r2 (ring radius)
+          the rest as draw_polygons
+Returns:
+Draws the torus add_torus would make, transformed by
+transform, without tessellating it
+====================*/
+void draw_torus_impostor( struct matrix * transform,
+                          double cx, double cy, double cz, double r1, double r2,
+                          screen s, zbuffer zb,
+                          double * view, struct lights * lights, color ambient,
+                          struct constants * reflect) {
+    struct impostor im;
+    double lo[3], hi[3];
+
+    torus_bounds(cx, cy, cz, r1, r2, lo, hi);
+    if (!impostor_setup(&im, transform, lo, hi)) return;
+
+    im.type = TORUS;
+    im.c[0] = cx;
+    im.c[1] = cy;
+    im.c[2] = cz;
+    im.r = r1;
+    im.ring = r2;
+    im.s = s;
+    im.zb = zb;
+    im.view = view;
+    im.lights = lights;
+    im.ambient = ambient;
+    im.reflect = reflect;
+    draw_impostor(&im);
+}
@@ -0,0 +1,23 @@
+#ifndef IMPOSTOR_H
+#define IMPOSTOR_H
+
+#include "matrix.h"
+#include "ml6.h"
+#include "symtab.h"
+#include "gmath.h"
+
+// Screen rows handled by one pool task
+#define IMPOSTOR_ROWS 16
+
+void draw_sphere_impostor( struct matrix * transform,
+                           double cx, double cy, double cz, double r,
+                           screen s, zbuffer zb,
+                           double * view, struct lights * lights, color ambient,
+                           struct constants * reflect);
+void draw_torus_impostor( struct matrix * transform,
+                          double cx, double cy, double cz, double r1, double r2,
+                          screen s, zbuffer zb,
+                          double * view, struct lights * lights, color ambient,
+                          struct constants * reflect);
+
+#endif
@@ -349,3 +349,30 @@ void copy_matrix(struct matrix *a, struct matrix *b) {
         }
     }
 }
+
+/*-------------- void transform_bounds() --------------
+Inputs:  struct matrix *t
+double *lo, double *hi
+double *bmin, double *bmax
+
+Sets bmin and bmax to the axis aligned bounds of the box lo
+to hi after transforming it by t, from its 8 corners
+*/
+void transform_bounds(struct matrix *t, double *lo, double *hi,
+                      double *bmin, double *bmax) {
+    for (int corner = 0; corner < 8; corner++) {
+        double p[3];
+
+        p[0] = corner & 1 ? hi[0] : lo[0];
+        p[1] = corner & 2 ? hi[1] : lo[1];
+        p[2] = corner & 4 ? hi[2] : lo[2];
+
+        for (int r = 0; r < 3; r++) {
+            double v = t -> m[r][0] * p[0] + t -> m[r][1] * p[1]
+                     + t -> m[r][2] * p[2] + t -> m[r][3];
+
+            if (corner == 0 || v < bmin[r]) bmin[r] = v;
+            if (corner == 0 || v > bmax[r]) bmax[r] = v;
+        }
+    }
+}
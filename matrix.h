@@ -32,5 +32,7 @@ void copy_matrix(struct matrix *a, struct matrix *b);
 void print_matrix(struct matrix *m);
 void ident(struct matrix *m);
 void matrix_mult(struct matrix *a, struct matrix *b);
+void transform_bounds(struct matrix *t, double *lo, double *hi,
+                      double *bmin, double *bmax);
 
 #endif
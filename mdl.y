@@ -5,6 +5,8 @@
     #include <string.h>
     #include "parser.h"
     #include "matrix.h"
+    #include "config.h"
+    #include "pool.h"
 
     #define YYERROR_VERBOSE 1
 
@@ -784,7 +786,10 @@ extern FILE *yyin;
 
 int main(int argc, char **argv) {
 
-    yyin = fopen(argv[1],"r");
+    int script = parse_args(argc, argv);
+
+    yyin = fopen(argv[script],"r");
+    pool_init(opts.threads);
 
     yyparse();
     //COMMENT OUT PRINT_PCODE AND UNCOMMENT
@@ -792,6 +797,7 @@ int main(int argc, char **argv) {
 
     //print_pcode();
     my_main();
+    pool_shutdown();
 
     return 0;
 }
@@ -10,20 +10,31 @@ Creates the point structure in order to represent a pixel as a color triple
 #ifndef ML6_H
 #define ML6_H
 
-#define XRES 500
-#define YRES 500
+// The screen size, DEFAULT_XRES x DEFAULT_YRES unless -x sets
+// another before anything is drawn
+#define DEFAULT_XRES 500
+#define DEFAULT_YRES 500
+extern int xres, yres;
+#define XRES xres
+#define YRES yres
+// Largest width or height -x takes
+#define MAX_RES 16384
 #define MAX_COLOR 255
 #define DEFAULT_COLOR 255
 
 /*
-  Every point has an individual int for
-  each color value
+  Every point has a byte for each color value, packed with
+  an alpha byte into 4 bytes so a pixel is one 32 bit word.
+  Lighting adds its terms up in ints and clamps to
+  MAX_COLOR before anything is stored in one. Every color
+  drawn is opaque, with alpha MAX_COLOR.
 */
 struct point_t {
 
-  unsigned short red;
-  unsigned short green;
-  unsigned short blue;
+  unsigned char red;
+  unsigned char green;
+  unsigned char blue;
+  unsigned char alpha;
 } point_t;
 
 /*
@@ -33,19 +44,33 @@ struct point_t {
   c.red = 0;
   c.green = 45;
   c.blue = 187;
+  c.alpha = MAX_COLOR;
 */
 typedef struct point_t color;
 
 /*
   Likewise, we can use screen as a data type representing
-  an XRES x YRES array of colors.
+  an XRES x YRES array of colors, made by new_screen. It's
+  stored a row at a time from the top of the image down,
+  so a row of pixels is contiguous and pixel (x, y) is
+  s[YRES - 1 - y][x].
   eg:
-  screen s;
+  screen s = new_screen();
   s[0][0] = c;
 */
-typedef struct point_t screen[XRES][YRES];
+typedef struct point_t ** screen;
 
-//z-buffer is a 2d array of doubles to store z values
-typedef double zbuffer[XRES][YRES];
+/*
+  z-buffer is a 2d array of floats to store z values, laid
+  out like screen. Depth is worked out in doubles and only
+  rounded to float when it's tested and stored, so every
+  test compares the float a pixel would store, eg:
+  float zf = z;
+  if (zf > zb[row][x]) zb[row][x] = zf;
+*/
+typedef float ** zbuffer;
+
+// Bytes the pixels of a screen or zbuffer are aligned to
+#define SCREEN_ALIGN 64
 
 #endif
@@ -38,6 +38,22 @@
 #include "draw.h"
 #include "stack.h"
 #include "gmath.h"
+#include "config.h"
+#include "hiz.h"
+#include "gbuffer.h"
+#include "impostor.h"
+#include "wire.h"
+#include "aa.h"
+#include "packed.h"
+#include "order.h"
+#include "span.h"
+#include "prepass.h"
+#include "gouraud.h"
+#include "shadow.h"
+#include "texture.h"
+#include "camera.h"
+#include "ray.h"
+#include "views.h"
 
 /*======== void first_pass() ==========
     Inputs:
@@ -166,42 +182,265 @@ struct vary_node ** second_pass() {
     return knobs;
 }
 
+/*======== void collect_lights() ==========
+    Inputs:   struct lights * lights
+              color * ambient
+    Returns:
+    Gathers every light the script declares into lights,
+    up to MAX_LIGHTS, and takes the last ambient command.
+    Lights apply to the whole script wherever they appear.
+    Without any, the scene keeps the single default light
+    lights already holds.
+    ====================*/
+void collect_lights(struct lights * lights, color * ambient) {
+    struct lights found;
+    found.count = 0;
+
+    for (int i = 0; i < lastop; i++) {
+        if (op[i].opcode == LIGHT) {
+            struct light * l = op[i].op.light.p -> s.l;
+
+            if (!add_light(&found, l -> l, op[i].op.light.c))
+                printf("Light %s ignored, only %d lights are supported\n",
+                       op[i].op.light.p -> name, MAX_LIGHTS);
+        }
+        else if (op[i].opcode == AMBIENT) {
+            ambient -> red = op[i].op.ambient.c[0];
+            ambient -> green = op[i].op.ambient.c[1];
+            ambient -> blue = op[i].op.ambient.c[2];
+        }
+    }
+
+    if (found.count > 0) *lights = found;
+}
+
+/*======== void collect_camera() ==========
+    Inputs:
+    Returns:
+    Sets up the script's camera, from the last camera and
+    focal commands, wherever they appear. Without a camera
+    the scene stays orthographic. With -v every camera
+    command makes a view, all with the last focal.
+    ====================*/
+void collect_camera() {
+    double focal = 0;
+    int camera = -1;
+
+    for (int i = 0; i < lastop; i++) {
+        if (op[i].opcode == CAMERA) camera = i;
+        else if (op[i].opcode == FOCAL) focal = op[i].op.focal.value;
+    }
+
+    if (camera < 0) return;
+
+    if (opts.views) {
+        for (int i = 0; i < lastop; i++) {
+            if (op[i].opcode != CAMERA) continue;
+            if (camera_count() == CAMERA_VIEWS) {
+                fprintf(stderr, "-v draws from at most %d cameras, ignoring the rest\n", CAMERA_VIEWS);
+                break;
+            }
+            camera_add(op[i].op.camera.eye, op[i].op.camera.aim, focal);
+        }
+        views_init();
+    }
+    else camera_set(op[camera].op.camera.eye, op[camera].op.camera.aim, focal);
+
+    // impostors are fit to an orthographic screen
+    if (camera_active() && opts.impostors) {
+        fprintf(stderr, "-i can't be used with a camera, ignoring -i\n");
+        opts.impostors = 0;
+    }
+}
+
+/*======== void flush_frame() ==========
+    Inputs:   screen s
+              zbuffer zb
+              the lighting inputs of draw_polygons
+    Returns:
+    Finishes what the options leave for the end of a frame:
+    queued and traced shapes, spans, shadows and the resolves,
+    so s holds the whole image before a save or display.
+    ====================*/
+void flush_frame(screen s, zbuffer zb, double * view,
+                 struct lights * lights, color ambient) {
+    if (opts.order) order_flush(s, zb, view, lights, ambient);
+    if (opts.prepass) prepass_flush(s, zb);
+    if (opts.spans) span_resolve(opts.deferred ? gbuffer : s, zb);
+    ray_flush(s, zb, view, lights, ambient);
+    if (opts.shadows) shadow_update(lights);
+    if (opts.deferred) gbuffer_resolve(s, zb);
+    if (opts.aa > 1) aa_resolve(s);
+    if (opts.packed) packed_resolve(s, zb);
+}
+
+/*======== void draw_shape() ==========
+    Inputs:   struct command * c (a sphere, torus or box)
+              struct matrix * temp
+              struct matrix * transform
+              screen s
+              zbuffer zb
+              the lighting inputs of draw_polygons
+              struct constants * reflect (when c names none)
+              double step
+              int verbose
+    Returns:
+    Runs one shape command: casts its shadow, then traces,
+    culls, queues, occlusion tests, draws it as an impostor
+    or tessellates and draws it, as the options ask. With
+    verbose it prints which, for the single frame pass.
+    ====================*/
+void draw_shape(struct command * c, struct matrix * temp, struct matrix * transform,
+                screen s, zbuffer zb, double * view, struct lights * lights,
+                color ambient, struct constants * reflect, double step, int verbose) {
+    double d[6] = {0};
+    double lo[3], hi[3];
+    SYMTAB * symbols;
+    SYMTAB * cs;
+    char * label;
+    int type;
+
+    if (c -> opcode == SPHERE) {
+        type = ORDER_SPHERE;
+        label = "Sphere";
+        for (int k = 0; k < 3; k++) d[k] = c -> op.sphere.d[k];
+        d[3] = c -> op.sphere.r;
+        symbols = c -> op.sphere.constants;
+        cs = c -> op.sphere.cs;
+        sphere_bounds(d[0], d[1], d[2], d[3], lo, hi);
+    }
+    else if (c -> opcode == TORUS) {
+        type = ORDER_TORUS;
+        label = "Torus";
+        for (int k = 0; k < 3; k++) d[k] = c -> op.torus.d[k];
+        d[3] = c -> op.torus.r0;
+        d[4] = c -> op.torus.r1;
+        symbols = c -> op.torus.constants;
+        cs = c -> op.torus.cs;
+        torus_bounds(d[0], d[1], d[2], d[3], d[4], lo, hi);
+    }
+    else {
+        type = ORDER_BOX;
+        label = "Box";
+        for (int k = 0; k < 3; k++) {
+            d[k] = c -> op.box.d0[k];
+            d[k + 3] = c -> op.box.d1[k];
+        }
+        symbols = c -> op.box.constants;
+        cs = c -> op.box.cs;
+        box_bounds(d[0], d[1], d[2], d[3], d[4], d[5], lo, hi);
+    }
+
+    struct constants * k = symbols != NULL ? symbols -> s.c : reflect;
+
+    // cast shadows even when culled or queued below
+    if (opts.shadows) shadow_caster(type, d, transform, step);
+
+    // traced at the next flush, out of view or not, since it may cast shadows
+    if (shading_mode == SHADE_RAYTRACE) {
+        if (verbose) printf("%s: traced", label);
+        ray_shape(type, d, transform, k, step);
+        return;
+    }
+
+    // shapes entirely outside the view aren't even tessellated
+    if (!camera_visible(transform, lo, hi)) {
+        if (verbose) printf("%s: culled", label);
+        return;
+    }
+
+    if (opts.order) {
+        if (verbose) printf("%s: queued", label);
+        order_submit(type, d, transform, k, step);
+        return;
+    }
+
+    if (opts.hiz && hiz_object_occluded(zb, transform, lo, hi)) {
+        if (verbose) printf("%s: occluded", label);
+        return;
+    }
+
+    if (opts.impostors && shading_mode != SHADE_WIREFRAME && type != ORDER_BOX) {
+        if (type == ORDER_SPHERE)
+            draw_sphere_impostor(transform, d[0], d[1], d[2], d[3],
+                                 s, zb, view, lights, ambient, k);
+        else
+            draw_torus_impostor(transform, d[0], d[1], d[2], d[3], d[4],
+                                s, zb, view, lights, ambient, k);
+        return;
+    }
+
+    if (type == ORDER_SPHERE) add_sphere(temp, d[0], d[1], d[2], d[3], step);
+    else if (type == ORDER_TORUS) add_torus(temp, d[0], d[1], d[2], d[3], d[4], step);
+    else add_box(temp, d[0], d[1], d[2], d[3], d[4], d[5]);
+    matrix_mult(transform, temp);
+
+    if (verbose) {
+        if (type == ORDER_SPHERE)
+            printf("Sphere: %6.2f %6.2f %6.2f r = %6.2f",
+                    d[0], d[1], d[2], d[3]);
+        else if (type == ORDER_TORUS)
+            printf("Torus: %6.2f %6.2f %6.2f r0 = %6.2f r1 = %6.2f",
+                    d[0], d[1], d[2], d[3], d[4]);
+        else
+            printf("Box: d0: %6.2f %6.2f %6.2f d1: %6.2f %6.2f %6.2f",
+                    d[0], d[1], d[2], d[3], d[4], d[5]);
+        if (symbols != NULL) printf("\tconstants: %s", symbols -> name);
+        if (cs != NULL) printf("\tcs: %s", cs -> name);
+    }
+
+    draw_polygons(temp, s, zb, view, lights, ambient, k);
+    temp -> lastcol = 0;
+}
+
 void my_main() {
     struct vary_node ** knobs;
     first_pass();
     knobs = second_pass();
 
-	screen s;
-	zbuffer zb;
+	screen s = new_screen();
+	zbuffer zb = new_zbuffer();
 
     // Line Color
 	color cline;
 	cline.red = 0;
 	cline.green = 0;
 	cline.blue = 0;
+	cline.alpha = MAX_COLOR;
 
 	double polystep = 100;
+	// wireframe previews only show layout, so they tessellate coarser
+	double wirestep = 20;
+	// interpolated colors hide the facets, so smooth shading needs fewer
+	double smoothstep = 30;
+#define SHAPE_STEP (shading_mode == SHADE_WIREFRAME ? wirestep : \
+                    shading_mode == SHADE_GOURAUD || shading_mode == SHADE_PHONG ? \
+                    smoothstep : polystep)
 
 	//Lighting values here for easy access
 	color ambient;
 	ambient.red = 50;
 	ambient.green = 50;
 	ambient.blue = 50;
+	ambient.alpha = MAX_COLOR;
+
+	double location[3] = {0.5, 0.75, 1};
+	double white_light[3] = {255, 255, 255};
 
-	double light[2][3];
-	light[LOCATION][0] = 0.5;
-	light[LOCATION][1] = 0.75;
-	light[LOCATION][2] = 1;
+	struct lights lights;
+	lights.count = 0;
+	add_light(&lights, location, white_light);
 
-	light[COLOR][RED] = 255;
-	light[COLOR][GREEN] = 255;
-	light[COLOR][BLUE] = 255;
+	collect_lights(&lights, &ambient);
 
 	double view[3];
 	view[0] = 0;
 	view[1] = 0;
 	view[2] = 1;
 
+	collect_camera();
+	camera_view(view);
+
 	//default reflective constants if none are set in script file
 	struct constants white;
 	white.r[AMBIENT_R] = 0.1;
@@ -235,6 +474,16 @@ void my_main() {
             systems = new_stack();
             clear_screen(s);
 	        clear_zbuffer(zb);
+            lighting_clear();
+            if (opts.hiz) hiz_clear();
+            if (opts.deferred) gbuffer_clear();
+            if (opts.aa > 1) aa_clear();
+            if (opts.packed) packed_clear();
+            if (opts.spans) span_clear();
+            if (opts.prepass) prepass_clear();
+            if (opts.shadows) shadow_clear();
+            if (opts.views) views_clear();
+            shading_mode = SHADE_FLAT;
 
             // Update symtab
             struct vary_node * node;
@@ -280,83 +529,12 @@ void my_main() {
 
                     //     break;
 
-                    case SPHERE: {
-                        double cx = op[i].op.sphere.d[0];
-                        double cy = op[i].op.sphere.d[1];
-                        double cz = op[i].op.sphere.d[2];
-                        double r = op[i].op.sphere.r;
-                        SYMTAB * symbols = op[i].op.sphere.constants;
-
-                        add_sphere(temp, cx, cy, cz, r, polystep);
-                        struct matrix * matrix = peek(systems);
-                        matrix_mult(matrix, temp);
-
-                        if (symbols != NULL) {
-                            draw_polygons(temp, s, zb, view, light, ambient, symbols -> s.c);
-                        }
-                        else {
-                            draw_polygons(temp, s, zb, view, light, ambient, reflect);
-                        }
-
-                        if (op[i].op.sphere.cs != NULL) {
-                        }
-
-                        temp -> lastcol = 0;
-                        break;
-                    }
-
-                    case TORUS: {
-                        double cx = op[i].op.torus.d[0];
-                        double cy = op[i].op.torus.d[1];
-                        double cz = op[i].op.torus.d[2];
-                        double r0 = op[i].op.torus.r0;
-                        double r1 = op[i].op.torus.r1;
-                        SYMTAB * symbols = op[i].op.torus.constants;
-
-                        add_torus(temp, cx, cy, cz, r0, r1, polystep);
-                        struct matrix * matrix = peek(systems);
-                        matrix_mult(matrix, temp);
-
-                        if (symbols != NULL) {
-                            draw_polygons(temp, s, zb, view, light, ambient, symbols -> s.c);
-                        }
-                        else {
-                            draw_polygons(temp, s, zb, view, light, ambient, reflect);
-                        }
-
-                        if (op[i].op.torus.cs != NULL) {
-                        }
-
-                        temp -> lastcol = 0;
-                        break;
-                    }
-
-                    case BOX: {
-                        double x = op[i].op.box.d0[0];
-                        double y = op[i].op.box.d0[1];
-                        double z = op[i].op.box.d0[2];
-                        double width = op[i].op.box.d1[0];
-                        double height = op[i].op.box.d1[1];
-                        double depth = op[i].op.box.d1[2];
-                        SYMTAB * symbols = op[i].op.box.constants;
-
-                        add_box(temp, x, y, z, width, height, depth);
-                        struct matrix * matrix = peek(systems);
-                        matrix_mult(matrix, temp);
-
-                        if (symbols != NULL) {
-                            draw_polygons(temp, s, zb, view, light, ambient, symbols -> s.c);
-                        }
-                        else {
-                            draw_polygons(temp, s, zb, view, light, ambient, reflect);
-                        }
-
-                        if (op[i].op.box.cs != NULL) {
-                        }
-
-                        temp -> lastcol = 0;
+                    case SPHERE:
+                    case TORUS:
+                    case BOX:
+                        draw_shape(&op[i], temp, peek(systems), s, zb, view, &lights,
+                                   ambient, reflect, SHAPE_STEP, 0);
                         break;
-                    }
 
                     case LINE: {
                         double x0 = op[i].op.line.p0[0];
@@ -385,6 +563,23 @@ void my_main() {
                         break;
                     }
                     
+                    case TEXTURE: {
+                        char * file = op[i].op.texture.p -> name;
+
+                        add_point(temp, op[i].op.texture.d0[0], op[i].op.texture.d0[1], op[i].op.texture.d0[2]);
+                        add_point(temp, op[i].op.texture.d1[0], op[i].op.texture.d1[1], op[i].op.texture.d1[2]);
+                        add_point(temp, op[i].op.texture.d2[0], op[i].op.texture.d2[1], op[i].op.texture.d2[2]);
+                        add_point(temp, op[i].op.texture.d3[0], op[i].op.texture.d3[1], op[i].op.texture.d3[2]);
+
+                        struct matrix * matrix = peek(systems);
+                        matrix_mult(matrix, temp);
+
+                        draw_texture(temp, file, s, zb);
+
+                        temp -> lastcol = 0;
+                        break;
+                    }
+
                     // case MESH:
                     //     printf("Mesh: filename: %s", op[i].op.mesh.name);
                     //     if (op[i].op.mesh.constants != NULL)
@@ -487,9 +682,9 @@ void my_main() {
                     //     printf("Generate Ray Files");
                     //     break;
 
-                    // case SHADING:
-                    //     printf("Shading: %s", op[i].op.shading.p -> name);
-                    //     break;
+                    case SHADING:
+                        shading_mode = shading_type(op[i].op.shading.p -> name);
+                        break;
 
                     // case SETKNOBS:
                     //     printf("Setknobs: %f", op[i].op.setknobs.value);
@@ -505,9 +700,12 @@ void my_main() {
             // Save Frame
             char frame_name[128];
             sprintf(frame_name, "anim/%s%03d.png", name, frame);
+            flush_frame(s, zb, view, &lights, ambient);
             save_extension(s, frame_name);
+            if (opts.views) views_save(frame_name);
             printf("Saved %s\n", frame_name);
         }
+        if (opts.views) views_animate(name);
         make_animation(name);
     }
 
@@ -519,6 +717,15 @@ void my_main() {
         systems = new_stack();
         clear_screen(s);
 	    clear_zbuffer(zb);
+        lighting_clear();
+        if (opts.hiz) hiz_clear();
+        if (opts.deferred) gbuffer_clear();
+        if (opts.aa > 1) aa_clear();
+        if (opts.packed) packed_clear();
+        if (opts.spans) span_clear();
+        if (opts.prepass) prepass_clear();
+        if (opts.shadows) shadow_clear();
+        if (opts.views) views_clear();
         
         for (int i = 0; i < lastop; i++) {
 		    printf("%d: ", i);
@@ -555,101 +762,12 @@ void my_main() {
 
                 //     break;
 
-                case SPHERE: {
-                    double cx = op[i].op.sphere.d[0];
-                    double cy = op[i].op.sphere.d[1];
-                    double cz = op[i].op.sphere.d[2];
-                    double r = op[i].op.sphere.r;
-                    SYMTAB * symbols = op[i].op.sphere.constants;
-
-                    add_sphere(temp, cx, cy, cz, r, polystep);
-                    struct matrix * matrix = peek(systems);
-                    matrix_mult(matrix, temp);
-
-                    printf("Sphere: %6.2f %6.2f %6.2f r = %6.2f",
-                            cx, cy, cz, r);
-
-                    if (symbols != NULL) {
-                        printf("\tconstants: %s", symbols -> name);
-
-                        draw_polygons(temp, s, zb, view, light, ambient, symbols -> s.c);
-                    }
-                    else {
-                        draw_polygons(temp, s, zb, view, light, ambient, reflect);
-                    }
-
-                    if (op[i].op.sphere.cs != NULL) {
-                        printf("\tcs: %s", op[i].op.sphere.cs -> name);
-                    }
-
-                    temp -> lastcol = 0;
+                case SPHERE:
+                case TORUS:
+                case BOX:
+                    draw_shape(&op[i], temp, peek(systems), s, zb, view, &lights,
+                               ambient, reflect, SHAPE_STEP, 1);
                     break;
-                }
-
-                case TORUS: {
-                    double cx = op[i].op.torus.d[0];
-                    double cy = op[i].op.torus.d[1];
-                    double cz = op[i].op.torus.d[2];
-                    double r0 = op[i].op.torus.r0;
-                    double r1 = op[i].op.torus.r1;
-                    SYMTAB * symbols = op[i].op.torus.constants;
-
-                    add_torus(temp, cx, cy, cz, r0, r1, polystep);
-                    struct matrix * matrix = peek(systems);
-                    matrix_mult(matrix, temp);
-                    
-                    printf("Torus: %6.2f %6.2f %6.2f r0 = %6.2f r1 = %6.2f",
-                            cx, cy, cz, r0, r1);
-
-                    if (symbols != NULL) {
-                        printf("\tconstants: %s", symbols -> name);
-
-                        draw_polygons(temp, s, zb, view, light, ambient, symbols -> s.c);
-                    }
-                    else {
-                        draw_polygons(temp, s, zb, view, light, ambient, reflect);
-                    }
-
-                    if (op[i].op.torus.cs != NULL) {
-                        printf("\tcs: %s", op[i].op.torus.cs -> name);
-                    }
-
-                    temp -> lastcol = 0;
-                    break;
-                }
-
-                case BOX: {
-                    double x = op[i].op.box.d0[0];
-                    double y = op[i].op.box.d0[1];
-                    double z = op[i].op.box.d0[2];
-                    double width = op[i].op.box.d1[0];
-                    double height = op[i].op.box.d1[1];
-                    double depth = op[i].op.box.d1[2];
-                    SYMTAB * symbols = op[i].op.box.constants;
-
-                    add_box(temp, x, y, z, width, height, depth);
-                    struct matrix * matrix = peek(systems);
-                    matrix_mult(matrix, temp);
-
-                    printf("Box: d0: %6.2f %6.2f %6.2f d1: %6.2f %6.2f %6.2f",
-                            x, y, z, width, height, depth);
-
-                    if (symbols != NULL) {
-                        printf("\tconstants: %s", symbols -> name);
-
-                        draw_polygons(temp, s, zb, view, light, ambient, symbols -> s.c);
-                    }
-                    else {
-                        draw_polygons(temp, s, zb, view, light, ambient, reflect);
-                    }
-
-                    if (op[i].op.box.cs != NULL) {
-                        printf("\tcs: %s", op[i].op.box.cs -> name);
-                    }
-
-                    temp -> lastcol = 0;
-                    break;
-                }
 
                 case LINE: {
                     double x0 = op[i].op.line.p0[0];
@@ -683,6 +801,25 @@ void my_main() {
                     break;
                 }
                 
+                case TEXTURE: {
+                    char * file = op[i].op.texture.p -> name;
+
+                    printf("Texture: %s", file);
+
+                    add_point(temp, op[i].op.texture.d0[0], op[i].op.texture.d0[1], op[i].op.texture.d0[2]);
+                    add_point(temp, op[i].op.texture.d1[0], op[i].op.texture.d1[1], op[i].op.texture.d1[2]);
+                    add_point(temp, op[i].op.texture.d2[0], op[i].op.texture.d2[1], op[i].op.texture.d2[2]);
+                    add_point(temp, op[i].op.texture.d3[0], op[i].op.texture.d3[1], op[i].op.texture.d3[2]);
+
+                    struct matrix * matrix = peek(systems);
+                    matrix_mult(matrix, temp);
+
+                    draw_texture(temp, file, s, zb);
+
+                    temp -> lastcol = 0;
+                    break;
+                }
+
                 // case MESH:
                 //     printf("Mesh: filename: %s", op[i].op.mesh.name);
                 //     if (op[i].op.mesh.constants != NULL)
@@ -792,14 +929,17 @@ void my_main() {
                     char * name = op[i].op.save.p -> name;
 
                     printf("Save: %s", name);
+                    flush_frame(s, zb, view, &lights, ambient);
                     save_extension(s, name);
+                    if (opts.views) views_save(name);
 
                     break;
                 }
 
-                // case SHADING:
-                //     printf("Shading: %s", op[i].op.shading.p -> name);
-                //     break;
+                case SHADING:
+                    printf("Shading: %s", op[i].op.shading.p -> name);
+                    shading_mode = shading_type(op[i].op.shading.p -> name);
+                    break;
 
                 // case SETKNOBS:
                 //     printf("Setknobs: %f", op[i].op.setknobs.value);
@@ -811,6 +951,7 @@ void my_main() {
 
                 case DISPLAY:
                     printf("Display");
+                    flush_frame(s, zb, view, &lights, ambient);
                     display(s);
 
                     break;
@@ -819,4 +960,16 @@ void my_main() {
             printf("\n");
 	    }
     }
+
+    if (opts.hiz) hiz_print_stats();
+    if (opts.deferred) gbuffer_print_stats();
+    if (wire_stats.edges) wire_print_stats();
+    if (opts.spans) span_print_stats();
+    if (opts.prepass) prepass_print_stats();
+    if (gouraud_stats.lit) gouraud_print_stats();
+    if (opts.shadows) shadow_print_stats();
+    if (texture_stats.loads) texture_print_stats();
+    if (ray_stats.primary) ray_print_stats();
+    if (camera_active() || camera_stats.objects_culled) camera_print_stats();
+    if (opts.traffic) display_print_stats();
 }
\ No newline at end of file
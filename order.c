@@ -0,0 +1,157 @@
+/*====================== order.c ========================
+Front to back drawing of the 3D shapes.
+
+With -o, sphere, torus and box commands are queued with a
+copy of the stack matrix instead of drawn. At the next save,
+display or frame end the queue is sorted by the nearest
+depth of each shape's transformed bounds, and drawn nearest
+first. Everything behind what's already drawn then fails
+the depth test before writing anything, and with -z whole
+shapes behind the first ones drawn are culled before they
+are even tessellated, which is where most of the savings
+come from. Equal depths keep script order.
+
+The depth test is strict, so where two shapes tie exactly in
+depth at a pixel the one drawn first keeps it. Drawing front
+to back can change which one that is, so the image can
+differ from drawing in script order by a pixel or two where
+the shapes touch, mostly where wireframe edges of different
+shapes cross or meet.
+
+Lines are still drawn right away; apart from those ties,
+depth testing makes the order they're drawn in not matter.
+==================================================*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <float.h>
+
+#include "ml6.h"
+#include "draw.h"
+#include "matrix.h"
+#include "symtab.h"
+#include "config.h"
+#include "hiz.h"
+#include "impostor.h"
+#include "camera.h"
+#include "order.h"
+
+struct draw_cmd {
+    int type;
+    double d[6];
+    struct matrix * transform;
+    struct constants * reflect;
+    double step;
+    int shading;
+
+    double near;    // sort key, the greatest z of the bounds
+    int seq;        // submission order, for ties
+};
+
+static struct draw_cmd * cmds = NULL;
+static int ncmds = 0;
+static int cmds_size = 0;
+
+static struct matrix * temp = NULL;
+
+static void cmd_bounds(struct draw_cmd * c, double * lo, double * hi) {
+    double * d = c -> d;
+
+    if (c -> type == ORDER_SPHERE) sphere_bounds(d[0], d[1], d[2], d[3], lo, hi);
+    else if (c -> type == ORDER_TORUS) torus_bounds(d[0], d[1], d[2], d[3], d[4], lo, hi);
+    else box_bounds(d[0], d[1], d[2], d[3], d[4], d[5], lo, hi);
+}
+
+/*======== void order_submit() ==========
+Inputs:   int type
+          double * d (the command's numbers, as add_* takes them)
+          struct matrix * transform
+          struct constants * reflect
+          double step
+Queues a shape to be drawn at the next order_flush
+====================*/
+void order_submit(int type, double * d, struct matrix * transform,
+                  struct constants * reflect, double step) {
+    if (ncmds == cmds_size) {
+        cmds_size = cmds_size ? cmds_size * 2 : 64;
+        cmds = realloc(cmds, cmds_size * sizeof(struct draw_cmd));
+    }
+
+    struct draw_cmd * c = &cmds[ncmds];
+    double lo[3], hi[3], bmin[3], bmax[3];
+
+    c -> type = type;
+    for (int i = 0; i < 6; i++) c -> d[i] = d[i];
+    c -> transform = new_matrix(4, 4);
+    copy_matrix(transform, c -> transform);
+    c -> reflect = reflect;
+    c -> step = step;
+    c -> shading = shading_mode;
+
+    cmd_bounds(c, lo, hi);
+    // reaching behind the camera, it's as near as can be
+    c -> near = camera_bounds(transform, lo, hi, bmin, bmax) ? bmax[2] : DBL_MAX;
+    c -> seq = ncmds++;
+}
+
+static int nearer_first(const void * a, const void * b) {
+    const struct draw_cmd * ca = a;
+    const struct draw_cmd * cb = b;
+
+    if (ca -> near != cb -> near) return ca -> near > cb -> near ? -1 : 1;
+    return ca -> seq - cb -> seq;
+}
+
+static void draw_cmd(struct draw_cmd * c, screen s, zbuffer zb,
+                     double * view, struct lights * lights, color ambient) {
+    double * d = c -> d;
+    double lo[3], hi[3];
+
+    cmd_bounds(c, lo, hi);
+    if (opts.hiz && hiz_object_occluded(zb, c -> transform, lo, hi)) return;
+
+    if (opts.impostors && shading_mode != SHADE_WIREFRAME && c -> type != ORDER_BOX) {
+        if (c -> type == ORDER_SPHERE)
+            draw_sphere_impostor(c -> transform, d[0], d[1], d[2], d[3],
+                                 s, zb, view, lights, ambient, c -> reflect);
+        else
+            draw_torus_impostor(c -> transform, d[0], d[1], d[2], d[3], d[4],
+                                s, zb, view, lights, ambient, c -> reflect);
+        return;
+    }
+
+    if (c -> type == ORDER_SPHERE) add_sphere(temp, d[0], d[1], d[2], d[3], c -> step);
+    else if (c -> type == ORDER_TORUS) add_torus(temp, d[0], d[1], d[2], d[3], d[4], c -> step);
+    else add_box(temp, d[0], d[1], d[2], d[3], d[4], d[5]);
+
+    matrix_mult(c -> transform, temp);
+    draw_polygons(temp, s, zb, view, lights, ambient, c -> reflect);
+    temp -> lastcol = 0;
+}
+
+/*======== void order_flush() ==========
+Inputs:   screen s
+          zbuffer zb
+          the lighting inputs of draw_polygons
+Draws everything queued, nearest first, and empties the
+queue
+====================*/
+void order_flush(screen s, zbuffer zb,
+                 double * view, struct lights * lights, color ambient) {
+    int shading = shading_mode;
+
+    // nothing queued, and cmds may not even be allocated yet
+    if (ncmds == 0) return;
+
+    if (!temp) temp = new_matrix(4, 1000);
+
+    qsort(cmds, ncmds, sizeof(struct draw_cmd), nearer_first);
+
+    for (int i = 0; i < ncmds; i++) {
+        shading_mode = cmds[i].shading;
+        draw_cmd(&cmds[i], s, zb, view, lights, ambient);
+        free_matrix(cmds[i].transform);
+    }
+    ncmds = 0;
+    shading_mode = shading;
+}
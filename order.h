@@ -0,0 +1,18 @@
+#ifndef ORDER_H
+#define ORDER_H
+
+#include "matrix.h"
+#include "ml6.h"
+#include "symtab.h"
+#include "gmath.h"
+
+#define ORDER_SPHERE 0
+#define ORDER_TORUS 1
+#define ORDER_BOX 2
+
+void order_submit(int type, double * d, struct matrix * transform,
+                  struct constants * reflect, double step);
+void order_flush(screen s, zbuffer zb,
+                 double * view, struct lights * lights, color ambient);
+
+#endif
@@ -0,0 +1,290 @@
+/*====================== packed.c ========================
+Lock free packed framebuffer for parallel primitives.
+
+With -p, draw_polygons only sets up and lights an object's
+triangles and queues them. At the next save, display or end
+of frame the whole queue is rasterized at once, split into
+chunks on the worker pool, so triangles of different
+objects are filled at the same time with no binning.
+
+Every pixel is a single 64 bit word: an order preserving
+key of the depth, rounded to a float like the zbuffer, in
+the high 32 bits, and the triangle's queue sequence number,
+inverted, in the low 32. A larger word is always the nearer
+fragment, and at equal depths the earlier triangle, so a
+write is a compare and swap loop that only ever raises the
+word, and whichever order threads get there the largest
+value stays. That is exactly the fragment the strict depth
+test keeps drawing serially. Colors are kept per triangle
+and looked up by sequence number at resolve.
+
+Triangles are walked exactly like scanline_convert, so the
+depths match. packed_resolve merges the words into the
+screen and zbuffer wherever they are nearer than the
+zbuffer, which is how anything drawn directly (lines,
+wireframes, impostors) composites with them.
+==================================================*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "ml6.h"
+#include "draw.h"
+#include "matrix.h"
+#include "symtab.h"
+#include "pool.h"
+#include "setup.h"
+#include "packed.h"
+
+// Cleared pixels are 0, below any depth key. Stored a row at
+// a time like a screen.
+static packed_pixel * fb = NULL;
+
+struct queued {
+    double v[9];    // x, y, z of the three vertices
+    unsigned seq;   // index into colors
+};
+
+static struct queued * queue = NULL;
+static int nqueued = 0;
+static int queue_size = 0;
+
+// Every triangle's color since the last clear, by sequence number
+static color * colors = NULL;
+static unsigned ncolors = 0;
+static unsigned colors_size = 0;
+
+/*======== packed_pixel depth_key() ==========
+Inputs:   double z
+Returns:  A 64 bit key in the high 32 bits that sorts the
+          same way as z as a float, with the low bits clear
+Flipping the sign bit of a positive float, or every bit
+of a negative one, makes the bits compare like the value.
+====================*/
+static packed_pixel depth_key(double z) {
+    // adding 0 turns -0 into 0, which the zbuffer treats as equal
+    float zf = (float) z + 0.0f;
+    unsigned u;
+
+    memcpy(&u, &zf, sizeof(u));
+    u = u >> 31 ? ~u : u | (1U << 31);
+    return (packed_pixel) u << 32;
+}
+
+static float key_depth(packed_pixel key) {
+    unsigned u = key >> 32;
+    float zf;
+
+    u = u >> 31 ? u & ~(1U << 31) : ~u;
+    memcpy(&zf, &u, sizeof(zf));
+    return zf;
+}
+
+static void packed_plot(int x, int y, double z, unsigned seq) {
+    packed_pixel * p = &fb[(YRES - 1 - y) * XRES + x];
+    packed_pixel v = depth_key(z) | ~seq;
+    packed_pixel old = __atomic_load_n(p, __ATOMIC_RELAXED);
+
+    while (v > old && !__atomic_compare_exchange_n(p, &old, v, 1, __ATOMIC_RELAXED,
+                                                   __ATOMIC_RELAXED));
+}
+
+/*======== void packed_span() ==========
+draw_scanline_clip, writing packed words
+====================*/
+static void packed_span(double x0, double z0, double x1, double z1, int y, double offx,
+                        unsigned seq) {
+    if (x0 > x1) {
+        swap(&x0, &x1);
+        swap(&z0, &z1);
+    }
+
+    int x = ceil(x0);
+    int xend = ceil(x1);
+
+    double mz = 0;
+    if ((x1 - x0) > 0) {
+        mz = (z1 - z0) / (x1 - x0);
+    }
+
+    double z = z0 + mz * offx;
+
+    if (xend > XRES) xend = XRES;
+    while (x < 0 && x < xend) {
+        z += mz;
+        x++;
+    }
+
+    while (x < xend) {
+        packed_plot(x, y, z, seq);
+
+        z += mz;
+        x++;
+    }
+}
+
+/*======== void packed_convert() ==========
+scanline_convert_clip on a queued triangle, clipped to the
+screen, writing packed words
+====================*/
+static void packed_convert(struct queued * t) {
+    double xb = t -> v[0], yb = t -> v[1], zb = t -> v[2];
+    double xm = t -> v[3], ym = t -> v[4], zm = t -> v[5];
+    double xt = t -> v[6], yt = t -> v[7], zt = t -> v[8];
+
+    if (yb > ym) {
+        swap(&yb, &ym);
+        swap(&xb, &xm);
+        swap(&zb, &zm);
+    }
+    if (ym > yt) {
+        swap(&ym, &yt);
+        swap(&xm, &xt);
+        swap(&zm, &zt);
+    }
+    if (yb > ym) {
+        swap(&yb, &ym);
+        swap(&xb, &xm);
+        swap(&zb, &zm);
+    }
+
+    double dist0 = yt - yb;
+    double dist1 = ym - yb;
+    double dist2 = yt - ym;
+
+    double mx0 = dist0 > 0 ? (xt - xb) / dist0 : 0;
+    double mx1 = dist1 > 0 ? (xm - xb) / dist1 : 0;
+    double mx2 = dist2 > 0 ? (xt - xm) / dist2 : 0;
+    double mz0 = dist0 > 0 ? (zt - zb) / dist0 : 0;
+    double mz1 = dist1 > 0 ? (zm - zb) / dist1 : 0;
+    double mz2 = dist2 > 0 ? (zt - zm) / dist2 : 0;
+
+    double offy0 = ceil(yb) - yb;
+    double offy1 = ceil(ym) - ym;
+
+    double x0 = xb + mx0 * offy0;
+    double x1 = xb + mx1 * offy0;
+    double x2 = xm + mx2 * offy1;
+    double z0 = zb + mz0 * offy0;
+    double z1 = zb + mz1 * offy0;
+    double z2 = zm + mz2 * offy1;
+    int y = ceil(yb);
+    int ytop = ceil(yt);
+
+    if (ytop > YRES) ytop = YRES;
+
+    int toggle = 1;
+    while (y < ytop) {
+        double offx;
+
+        if (y == ceil(ym) && toggle) {
+            x1 = x2;
+            z1 = z2;
+            mx1 = mx2;
+            mz1 = mz2;
+
+            toggle = 0;
+        }
+
+        if (y >= 0) {
+            if (x0 > x1) {
+                offx = ceil(x1) - x1;
+            }
+            else offx = ceil(x0) - x0;
+
+            packed_span(x0, z0, x1, z1, y, offx, t -> seq);
+        }
+        x0 += mx0;
+        x1 += mx1;
+        z0 += mz0;
+        z1 += mz1;
+        y++;
+    }
+}
+
+/*======== void packed_clear() ==========
+Empties the framebuffer and drops anything queued, to go
+with clear_zbuffer
+====================*/
+void packed_clear() {
+    if (!fb) fb = malloc((size_t) XRES * YRES * sizeof(packed_pixel));
+    memset(fb, 0, (size_t) XRES * YRES * sizeof(packed_pixel));
+    nqueued = 0;
+    ncolors = 0;
+}
+
+/*======== void packed_submit() ==========
+Inputs:   same as draw_polygons, without the targets
+Sets up and lights the triangles of polygons and queues
+the survivors
+====================*/
+void packed_submit( struct matrix * polygons,
+                    double * view, struct lights * lights, color ambient,
+                    struct constants * reflect) {
+    double ** m = polygons -> m;
+    struct triangles * tris = setup_triangles(polygons, view, lights, ambient, reflect);
+
+    if (nqueued + tris -> count > PACKED_MAX) packed_flush();
+
+    if (nqueued + tris -> count > queue_size) {
+        while (nqueued + tris -> count > queue_size)
+            queue_size = queue_size ? queue_size * 2 : 4096;
+        queue = realloc(queue, queue_size * sizeof(struct queued));
+    }
+    if (ncolors + tris -> count > colors_size) {
+        while (ncolors + tris -> count > colors_size)
+            colors_size = colors_size ? colors_size * 2 : 4096;
+        colors = realloc(colors, colors_size * sizeof(color));
+    }
+
+    for (int t = 0; t < tris -> count; t++) {
+        struct queued * q = &queue[nqueued++];
+        int col = tris -> cols[t];
+
+        for (int i = 0; i < 3; i++) {
+            q -> v[3 * i] = m[0][col + i];
+            q -> v[3 * i + 1] = m[1][col + i];
+            q -> v[3 * i + 2] = m[2][col + i];
+        }
+        q -> seq = ncolors;
+        colors[ncolors++] = tris -> colors[t];
+    }
+}
+
+static void draw_chunk(int index, void * arg) {
+    int end = (index + 1) * PACKED_CHUNK < nqueued ? (index + 1) * PACKED_CHUNK : nqueued;
+
+    for (int t = index * PACKED_CHUNK; t < end; t++)
+        packed_convert(&queue[t]);
+}
+
+/*======== void packed_flush() ==========
+Rasterizes everything queued, in parallel
+====================*/
+void packed_flush() {
+    pool_run((nqueued + PACKED_CHUNK - 1) / PACKED_CHUNK, draw_chunk, NULL);
+    nqueued = 0;
+}
+
+/*======== void packed_resolve() ==========
+Inputs:   screen s
+          zbuffer zb
+Flushes the queue, then copies every packed pixel nearer
+than zb into s and zb
+====================*/
+void packed_resolve(screen s, zbuffer zb) {
+    packed_flush();
+
+    for (int y = 0; y < YRES; y++) {
+        for (int x = 0; x < XRES; x++) {
+            packed_pixel p = fb[y * XRES + x];
+
+            if (!p || key_depth(p) <= zb[y][x]) continue;
+
+            zb[y][x] = key_depth(p);
+            s[y][x] = colors[~(unsigned) p];
+        }
+    }
+}
@@ -0,0 +1,24 @@
+#ifndef PACKED_H
+#define PACKED_H
+
+#include "matrix.h"
+#include "ml6.h"
+#include "symtab.h"
+#include "gmath.h"
+
+// Depth and draw order in one word, ordered so the nearer pixel is larger
+typedef unsigned long long packed_pixel;
+
+// Triangles rasterized by one pool task
+#define PACKED_CHUNK 1024
+// Flush once this many triangles are waiting
+#define PACKED_MAX 1000000
+
+void packed_clear();
+void packed_submit( struct matrix * polygons,
+                    double * view, struct lights * lights, color ambient,
+                    struct constants * reflect);
+void packed_flush();
+void packed_resolve(screen s, zbuffer zb);
+
+#endif
@@ -0,0 +1,18 @@
+#ifndef PHONG_H
+#define PHONG_H
+
+#include "matrix.h"
+#include "ml6.h"
+#include "symtab.h"
+#include "setup.h"
+
+// Pixels lit together, two SSE vectors
+#define PHONG_BATCH 8
+
+struct triangles * setup_phong( struct matrix * polygons,
+                                double * view, struct lights * lights, color ambient,
+                                struct constants * reflect);
+void phong_span(screen s, zbuffer zb, int x, int xend, int y,
+                double z, double mz, double * a, double * ma);
+
+#endif
@@ -0,0 +1,133 @@
+/*====================== pool.c ========================
+A small persistent worker pool.
+
+pool_run hands out task indices 0 to count - 1 to the
+workers and the calling thread, and returns once every
+task has finished. Tasks are claimed with an atomic counter
+so uneven tasks (busy tiles vs empty ones) balance out.
+==================================================*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "pool.h"
+
+static pthread_t * workers = NULL;
+static int nworkers = 0;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t start = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t done = PTHREAD_COND_INITIALIZER;
+
+static int generation = 0;
+static int busy = 0;
+static int quit = 0;
+
+static pool_task job;
+static void * job_arg;
+static int job_count;
+static int job_next;
+
+/*======== void drain() ==========
+Claims and runs tasks until none are left
+====================*/
+static void drain() {
+    int i;
+
+    while ((i = __atomic_fetch_add(&job_next, 1, __ATOMIC_RELAXED)) < job_count)
+        job(i, job_arg);
+}
+
+static void * worker(void * unused) {
+    int seen = 0;
+
+    pthread_mutex_lock(&lock);
+    while (1) {
+        while (generation == seen && !quit)
+            pthread_cond_wait(&start, &lock);
+        if (quit) break;
+        seen = generation;
+        pthread_mutex_unlock(&lock);
+
+        drain();
+
+        pthread_mutex_lock(&lock);
+        if (--busy == 0) pthread_cond_signal(&done);
+    }
+    pthread_mutex_unlock(&lock);
+
+    return NULL;
+}
+
+/*======== void pool_init() ==========
+Inputs:   int threads
+Starts threads - 1 workers, the caller of pool_run
+is the last one
+====================*/
+void pool_init(int threads) {
+    if (workers != NULL || threads <= 1) return;
+
+    nworkers = threads - 1;
+    workers = malloc(nworkers * sizeof(pthread_t));
+    for (int i = 0; i < nworkers; i++)
+        pthread_create(&workers[i], NULL, worker, NULL);
+}
+
+/*======== void pool_run() ==========
+Inputs:   int count
+          pool_task task
+          void * arg
+Runs task(i, arg) for every i in [0, count) and waits
+for all of them to finish
+====================*/
+void pool_run(int count, pool_task task, void * arg) {
+    if (count <= 0) return;
+
+    if (nworkers == 0 || count == 1) {
+        for (int i = 0; i < count; i++) task(i, arg);
+        return;
+    }
+
+    pthread_mutex_lock(&lock);
+    job = task;
+    job_arg = arg;
+    job_count = count;
+    job_next = 0;
+    busy = nworkers;
+    generation++;
+    pthread_cond_broadcast(&start);
+    pthread_mutex_unlock(&lock);
+
+    drain();
+
+    pthread_mutex_lock(&lock);
+    while (busy > 0)
+        pthread_cond_wait(&done, &lock);
+    pthread_mutex_unlock(&lock);
+}
+
+/*======== void pool_shutdown() ==========
+Stops and joins all workers
+====================*/
+void pool_shutdown() {
+    if (workers == NULL) return;
+
+    pthread_mutex_lock(&lock);
+    quit = 1;
+    pthread_cond_broadcast(&start);
+    pthread_mutex_unlock(&lock);
+
+    for (int i = 0; i < nworkers; i++)
+        pthread_join(workers[i], NULL);
+
+    free(workers);
+    workers = NULL;
+    nworkers = 0;
+    quit = 0;
+}
+
+// Number of threads that run tasks, including the caller
+int pool_threads() {
+    return nworkers + 1;
+}
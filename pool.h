@@ -0,0 +1,12 @@
+#ifndef POOL_H
+#define POOL_H
+
+// A task receives its index (0 to count - 1) and the shared argument
+typedef void (*pool_task)(int index, void * arg);
+
+void pool_init(int threads);
+void pool_run(int count, pool_task task, void * arg);
+void pool_shutdown();
+int pool_threads();
+
+#endif
@@ -0,0 +1,291 @@
+/*====================== prepass.c ========================
+Depth prepass.
+
+With -e, draw_polygons only culls an object's triangles and
+queues them, unlit. At the next save, display or end of
+frame the queue is drawn in two passes. The first fills
+depth alone, exactly as the normal fill would, so the
+zbuffer ends up the same. The second walks the triangles
+again and only writes pixels whose depth equals the
+zbuffer, and a triangle is lit the first time it owns one,
+so hidden triangles never get lit and every pixel gets its
+color written once.
+
+A pixel is claimed by the first triangle to match it in the
+second pass, since with a strict depth test the first of
+two triangles at the same depth is the one that stays.
+
+The first pass counts every depth write, which is how many
+pixels the normal fill would have colored, and the second
+counts the pixels actually shown, so the stats give the
+overdraw of the frame either way.
+==================================================*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "ml6.h"
+#include "draw.h"
+#include "gmath.h"
+#include "matrix.h"
+#include "symtab.h"
+#include "setup.h"
+#include "camera.h"
+#include "prepass.h"
+
+#define PASS_DEPTH 0
+#define PASS_COLOR 1
+
+// The lights of one draw_polygons call, prepared for its material
+struct pre_object {
+    struct lighting * ls;
+};
+
+struct pre_tri {
+    double v[9];    // x, y, z of the three vertices
+    double n[3];    // unnormalized normal
+    int object;
+    int lit;
+    color c;
+};
+
+struct prepass_stats prepass_stats;
+
+static struct pre_object * objects = NULL;
+static int nobjects = 0;
+static int objects_size = 0;
+
+static struct pre_tri * queue = NULL;
+static int nqueued = 0;
+static int queue_size = 0;
+
+// Pixels already colored by the second pass
+static char * claimed = NULL;
+
+/*======== void pre_pixel() ==========
+Inputs:   struct pre_tri * t
+          int pass
+          int x, y
+          double z
+          screen s
+          zbuffer zb
+Depth tests one pixel of t for the given pass
+====================*/
+static void pre_pixel(struct pre_tri * t, int pass, int x, int y, double z,
+                      screen s, zbuffer zb) {
+    int n = YRES - 1 - y;
+    float zf = z;
+
+    if (pass == PASS_DEPTH) {
+        if (zf > zb[n][x]) {
+            zb[n][x] = zf;
+            prepass_stats.depth_writes++;
+        }
+        return;
+    }
+
+    if (zf != zb[n][x] || claimed[n * XRES + x]) return;
+
+    if (!t -> lit) {
+        struct pre_object * o = &objects[t -> object];
+        double normal[3] = {t -> n[0], t -> n[1], t -> n[2]};
+
+        t -> c = lighting_color(o -> ls, normal);
+        t -> lit = 1;
+        prepass_stats.lit++;
+    }
+    s[n][x] = t -> c;
+    claimed[n * XRES + x] = 1;
+    prepass_stats.shaded++;
+}
+
+/*======== void pre_scanline() ==========
+draw_scanline_clip, clipped to the screen, for one pass
+====================*/
+static void pre_scanline(double x0, double z0, double x1, double z1, int y, double offx,
+                         struct pre_tri * t, int pass, screen s, zbuffer zb) {
+    if (x0 > x1) {
+        swap(&x0, &x1);
+        swap(&z0, &z1);
+    }
+
+    int x = ceil(x0);
+    int xend = ceil(x1);
+
+    double mz = 0;
+    if ((x1 - x0) > 0) {
+        mz = (z1 - z0) / (x1 - x0);
+    }
+
+    double z = z0 + mz * offx;
+
+    if (xend > XRES) xend = XRES;
+    while (x < 0 && x < xend) {
+        z += mz;
+        x++;
+    }
+
+    while (x < xend) {
+        pre_pixel(t, pass, x, y, z, s, zb);
+
+        z += mz;
+        x++;
+    }
+}
+
+/*======== void pre_convert() ==========
+scanline_convert_clip on a queued triangle, clipped to the
+screen, for one pass
+====================*/
+static void pre_convert(struct pre_tri * t, int pass, screen s, zbuffer zb) {
+    double xb = t -> v[0], yb = t -> v[1], zb0 = t -> v[2];
+    double xm = t -> v[3], ym = t -> v[4], zm = t -> v[5];
+    double xt = t -> v[6], yt = t -> v[7], zt = t -> v[8];
+
+    if (yb > ym) {
+        swap(&yb, &ym);
+        swap(&xb, &xm);
+        swap(&zb0, &zm);
+    }
+    if (ym > yt) {
+        swap(&ym, &yt);
+        swap(&xm, &xt);
+        swap(&zm, &zt);
+    }
+    if (yb > ym) {
+        swap(&yb, &ym);
+        swap(&xb, &xm);
+        swap(&zb0, &zm);
+    }
+
+    double dist0 = yt - yb;
+    double dist1 = ym - yb;
+    double dist2 = yt - ym;
+
+    double mx0 = dist0 > 0 ? (xt - xb) / dist0 : 0;
+    double mx1 = dist1 > 0 ? (xm - xb) / dist1 : 0;
+    double mx2 = dist2 > 0 ? (xt - xm) / dist2 : 0;
+    double mz0 = dist0 > 0 ? (zt - zb0) / dist0 : 0;
+    double mz1 = dist1 > 0 ? (zm - zb0) / dist1 : 0;
+    double mz2 = dist2 > 0 ? (zt - zm) / dist2 : 0;
+
+    double offy0 = ceil(yb) - yb;
+    double offy1 = ceil(ym) - ym;
+
+    double x0 = xb + mx0 * offy0;
+    double x1 = xb + mx1 * offy0;
+    double x2 = xm + mx2 * offy1;
+    double z0 = zb0 + mz0 * offy0;
+    double z1 = zb0 + mz1 * offy0;
+    double z2 = zm + mz2 * offy1;
+    int y = ceil(yb);
+    int ytop = ceil(yt);
+
+    if (ytop > YRES) ytop = YRES;
+
+    int toggle = 1;
+    while (y < ytop) {
+        double offx;
+
+        if (y == ceil(ym) && toggle) {
+            x1 = x2;
+            z1 = z2;
+            mx1 = mx2;
+            mz1 = mz2;
+
+            toggle = 0;
+        }
+
+        if (y >= 0) {
+            if (x0 > x1) {
+                offx = ceil(x1) - x1;
+            }
+            else offx = ceil(x0) - x0;
+
+            pre_scanline(x0, z0, x1, z1, y, offx, t, pass, s, zb);
+        }
+        x0 += mx0;
+        x1 += mx1;
+        z0 += mz0;
+        z1 += mz1;
+        y++;
+    }
+}
+
+/*======== void prepass_clear() ==========
+Drops anything queued, to go with clear_zbuffer
+====================*/
+void prepass_clear() {
+    nqueued = 0;
+    nobjects = 0;
+}
+
+/*======== void prepass_submit() ==========
+Inputs:   same as draw_polygons, without the targets
+Culls the triangles of polygons and queues the survivors
+with their normals, to be lit if they turn out visible
+====================*/
+void prepass_submit( struct matrix * polygons,
+                     double * view, struct lights * lights, color ambient,
+                     struct constants * reflect) {
+    double ** m = polygons -> m;
+    struct triangles * tris = setup_triangles(polygons, view, lights, ambient, reflect);
+
+    if (nobjects == objects_size) {
+        objects_size = objects_size ? objects_size * 2 : 64;
+        objects = realloc(objects, objects_size * sizeof(struct pre_object));
+    }
+
+    objects[nobjects].ls = lighting_get(view, lights, ambient, reflect);
+
+    if (nqueued + tris -> count > queue_size) {
+        while (nqueued + tris -> count > queue_size)
+            queue_size = queue_size ? queue_size * 2 : 4096;
+        queue = realloc(queue, queue_size * sizeof(struct pre_tri));
+    }
+
+    for (int t = 0; t < tris -> count; t++) {
+        struct pre_tri * q = &queue[nqueued++];
+        int col = tris -> cols[t];
+
+        for (int i = 0; i < 3; i++) {
+            q -> v[3 * i] = m[0][col + i];
+            q -> v[3 * i + 1] = m[1][col + i];
+            q -> v[3 * i + 2] = m[2][col + i];
+        }
+        surface_normal(q -> n, polygons, col);
+        q -> object = nobjects;
+        q -> lit = 0;
+    }
+    nobjects++;
+    prepass_stats.triangles += tris -> count;
+}
+
+/*======== void prepass_flush() ==========
+Inputs:   screen s
+          zbuffer zb
+Draws everything queued, depth first, then colors only the
+pixels that kept their triangle's depth
+====================*/
+void prepass_flush(screen s, zbuffer zb) {
+    if (!nqueued) return;
+
+    for (int t = 0; t < nqueued; t++)
+        pre_convert(&queue[t], PASS_DEPTH, s, zb);
+
+    if (!claimed) claimed = malloc((size_t) XRES * YRES);
+    memset(claimed, 0, (size_t) XRES * YRES);
+    for (int t = 0; t < nqueued; t++)
+        pre_convert(&queue[t], PASS_COLOR, s, zb);
+
+    prepass_clear();
+}
+
+void prepass_print_stats() {
+    printf("Prepass: lit %ld of %ld triangles, %ld depth writes for %ld pixels shown (overdraw %.2f)\n",
+           prepass_stats.lit, prepass_stats.triangles,
+           prepass_stats.depth_writes, prepass_stats.shaded,
+           prepass_stats.shaded ? (double) prepass_stats.depth_writes / prepass_stats.shaded : 0);
+}
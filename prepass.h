@@ -0,0 +1,25 @@
+#ifndef PREPASS_H
+#define PREPASS_H
+
+#include "matrix.h"
+#include "ml6.h"
+#include "symtab.h"
+#include "gmath.h"
+
+struct prepass_stats {
+    long triangles;
+    long lit;
+    long depth_writes;
+    long shaded;
+};
+
+extern struct prepass_stats prepass_stats;
+
+void prepass_clear();
+void prepass_submit( struct matrix * polygons,
+                     double * view, struct lights * lights, color ambient,
+                     struct constants * reflect);
+void prepass_flush(screen s, zbuffer zb);
+void prepass_print_stats();
+
+#endif
@@ -0,0 +1,658 @@
+/*====================== ray.c ========================
+Ray tracing, for shading raytrace.
+
+In raytrace mode sphere, torus and box commands aren't
+drawn right away. Each is transformed by the stack matrix
+and kept, as triangles or, for a sphere whose matrix only
+rotates, scales evenly and moves, as an exact sphere. At
+the next save or display ray_flush builds a bounding volume
+hierarchy over all of them and traces the screen.
+
+The hierarchy is split with the surface area heuristic over
+RAY_BINS buckets of primitive centers along the longest
+axis, down to RAY_LEAF primitives, and laid out depth first
+so a node's first child is the next node. Rays visit the
+nearer child first and skip anything behind the nearest hit
+so far.
+
+Every pixel gets a primary ray through its center, the same
+spot the rasterizers sample, or through each sample of it
+with -a. The nearest hit goes through the zbuffer test, so
+traced and rasterized shapes composite. It's lit with the
+lights of its material, leaving out every light a shadow ray
+toward it hits something on the way. Shapes outside the view
+are still kept, since they can cast shadows into it.
+
+Tiles of RAY_TILE pixels are traced in parallel on the
+worker pool; the hierarchy and the lights are only read
+there. The build and trace times go in the stats along with
+the ray counts, so rays per second can be compared between
+-t settings.
+==================================================*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <float.h>
+#include <math.h>
+#include <time.h>
+
+#include "ml6.h"
+#include "draw.h"
+#include "gmath.h"
+#include "matrix.h"
+#include "symtab.h"
+#include "pool.h"
+#include "config.h"
+#include "hiz.h"
+#include "gbuffer.h"
+#include "aa.h"
+#include "order.h"
+#include "camera.h"
+#include "views.h"
+#include "ray.h"
+
+#define TRIANGLE 0
+#define SPHERE 1
+
+struct prim {
+    int type;
+    int material;
+    double p[9];        // triangle corners, or center and radius
+};
+
+struct node {
+    double lo[3], hi[3];
+    int start;          // a leaf's first primitive, or the second child
+    int count;          // primitives in a leaf, 0 for the rest
+};
+
+struct ray {
+    double o[3], d[3];
+    double inv[3];      // 1 / d, for the box tests
+    double tmin, tmax;
+};
+
+struct trace {
+    screen s;
+    zbuffer zb;
+    struct lighting ** prepared;
+    int tiles_x, tiles;
+};
+
+struct ray_stats ray_stats;
+
+static struct prim * prims = NULL;
+static int nprims = 0;
+static int prims_size = 0;
+
+static struct node * nodes = NULL;
+static int nnodes = 0;
+static int nodes_size = 0;
+
+static struct constants ** materials = NULL;
+static int nmaterials = 0;
+static int materials_size = 0;
+
+static double now_ms() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static struct prim * add_prim(int type, struct constants * reflect) {
+    if (nprims == prims_size) {
+        prims_size = prims_size ? prims_size * 2 : 4096;
+        prims = realloc(prims, prims_size * sizeof(struct prim));
+    }
+
+    // consecutive shapes nearly always share a material
+    if (nmaterials == 0 || materials[nmaterials - 1] != reflect) {
+        if (nmaterials == materials_size) {
+            materials_size = materials_size ? materials_size * 2 : 16;
+            materials = realloc(materials, materials_size * sizeof(struct constants *));
+        }
+        materials[nmaterials++] = reflect;
+    }
+
+    struct prim * p = &prims[nprims++];
+    p -> type = type;
+    p -> material = nmaterials - 1;
+    return p;
+}
+
+/*======== int sphere_similar() ==========
+Inputs:   struct matrix * transform
+          double * scale
+Returns:  Whether transform keeps spheres round, setting
+          scale to how much it grows them
+====================*/
+static int sphere_similar(struct matrix * transform, double * scale) {
+    double ** m = transform -> m;
+    double c[3][3];
+
+    for (int i = 0; i < 3; i++)
+        for (int r = 0; r < 3; r++)
+            c[i][r] = m[r][i];
+
+    double s2 = dot_product(c[0], c[0]);
+    double tolerance = 1e-9 * s2;
+
+    if (s2 == 0) return 0;
+    if (fabs(dot_product(c[1], c[1]) - s2) > tolerance) return 0;
+    if (fabs(dot_product(c[2], c[2]) - s2) > tolerance) return 0;
+    if (fabs(dot_product(c[0], c[1])) > tolerance) return 0;
+    if (fabs(dot_product(c[0], c[2])) > tolerance) return 0;
+    if (fabs(dot_product(c[1], c[2])) > tolerance) return 0;
+
+    *scale = sqrt(s2);
+    return 1;
+}
+
+/*======== void ray_shape() ==========
+Inputs:   int type (ORDER_SPHERE, ORDER_TORUS or ORDER_BOX)
+          double * d (the command's numbers, as add_* takes them)
+          struct matrix * transform
+          struct constants * reflect
+          double step
+Keeps a shape, as the stack matrix puts it, to be traced at
+the next flush
+====================*/
+void ray_shape(int type, double * d, struct matrix * transform,
+               struct constants * reflect, double step) {
+    double scale;
+
+    if (type == ORDER_SPHERE && sphere_similar(transform, &scale)) {
+        struct prim * p = add_prim(SPHERE, reflect);
+
+        for (int r = 0; r < 3; r++)
+            p -> p[r] = transform -> m[r][0] * d[0] + transform -> m[r][1] * d[1]
+                + transform -> m[r][2] * d[2] + transform -> m[r][3];
+        p -> p[3] = d[3] * scale;
+        return;
+    }
+
+    struct matrix * temp = new_matrix(4, 1000);
+
+    if (type == ORDER_SPHERE) add_sphere(temp, d[0], d[1], d[2], d[3], step);
+    else if (type == ORDER_TORUS) add_torus(temp, d[0], d[1], d[2], d[3], d[4], step);
+    else add_box(temp, d[0], d[1], d[2], d[3], d[4], d[5]);
+    matrix_mult(transform, temp);
+
+    for (int col = 0; col + 2 < temp -> lastcol; col += 3) {
+        struct prim * p = add_prim(TRIANGLE, reflect);
+
+        for (int v = 0; v < 3; v++)
+            for (int k = 0; k < 3; k++)
+                p -> p[3 * v + k] = temp -> m[k][col + v];
+    }
+
+    free_matrix(temp);
+}
+
+static void prim_bounds(struct prim * p, double * lo, double * hi) {
+    if (p -> type == SPHERE) {
+        for (int k = 0; k < 3; k++) {
+            lo[k] = p -> p[k] - p -> p[3];
+            hi[k] = p -> p[k] + p -> p[3];
+        }
+        return;
+    }
+
+    for (int k = 0; k < 3; k++) {
+        lo[k] = fmin(p -> p[k], fmin(p -> p[3 + k], p -> p[6 + k]));
+        hi[k] = fmax(p -> p[k], fmax(p -> p[3 + k], p -> p[6 + k]));
+    }
+}
+
+static void grow(double * lo, double * hi, double * blo, double * bhi) {
+    for (int k = 0; k < 3; k++) {
+        if (blo[k] < lo[k]) lo[k] = blo[k];
+        if (bhi[k] > hi[k]) hi[k] = bhi[k];
+    }
+}
+
+static double area(double * lo, double * hi) {
+    double x = hi[0] - lo[0], y = hi[1] - lo[1], z = hi[2] - lo[2];
+
+    return x * y + y * z + z * x;
+}
+
+/*======== int build() ==========
+Inputs:   int * order (primitive indices, reordered in place)
+          double (*bounds)[6] (each primitive's lo and hi)
+          int first, count
+          int depth
+Returns:  The node over order[first] to order[first + count - 1]
+Splits at the bucket boundary the surface area heuristic
+likes best. Buckets are laid out between the smallest and
+largest center, so both ends always have something in them.
+====================*/
+static int build(int * order, double (*bounds)[6], int first, int count, int depth) {
+    if (nnodes == nodes_size) {
+        nodes_size = nodes_size ? nodes_size * 2 : 1024;
+        nodes = realloc(nodes, nodes_size * sizeof(struct node));
+    }
+
+    int index = nnodes++;
+    double lo[3] = {DBL_MAX, DBL_MAX, DBL_MAX};
+    double hi[3] = {-DBL_MAX, -DBL_MAX, -DBL_MAX};
+    double cmin[3] = {DBL_MAX, DBL_MAX, DBL_MAX};
+    double cmax[3] = {-DBL_MAX, -DBL_MAX, -DBL_MAX};
+
+    for (int i = first; i < first + count; i++) {
+        double * b = bounds[order[i]];
+        double c[3] = {(b[0] + b[3]) / 2, (b[1] + b[4]) / 2, (b[2] + b[5]) / 2};
+
+        grow(lo, hi, b, b + 3);
+        grow(cmin, cmax, c, c);
+    }
+    memcpy(nodes[index].lo, lo, sizeof(lo));
+    memcpy(nodes[index].hi, hi, sizeof(hi));
+    nodes[index].start = first;
+    nodes[index].count = count;
+
+    int axis = 0;
+    for (int k = 1; k < 3; k++)
+        if (cmax[k] - cmin[k] > cmax[axis] - cmin[axis]) axis = k;
+
+    double extent = cmax[axis] - cmin[axis];
+    if (count <= RAY_LEAF || extent <= 0 || depth == RAY_DEPTH) return index;
+
+    int counts[RAY_BINS] = {0};
+    double blo[RAY_BINS][3], bhi[RAY_BINS][3];
+
+    for (int b = 0; b < RAY_BINS; b++)
+        for (int k = 0; k < 3; k++) {
+            blo[b][k] = DBL_MAX;
+            bhi[b][k] = -DBL_MAX;
+        }
+
+    for (int i = first; i < first + count; i++) {
+        double * b = bounds[order[i]];
+        int bin = (int) (RAY_BINS * ((b[axis] + b[axis + 3]) / 2 - cmin[axis]) / extent);
+
+        if (bin >= RAY_BINS) bin = RAY_BINS - 1;
+        counts[bin]++;
+        grow(blo[bin], bhi[bin], b, b + 3);
+    }
+
+    // right to left sweep, so the left to right one can price every split
+    double right_area[RAY_BINS];
+    int right_count[RAY_BINS];
+    double rlo[3] = {DBL_MAX, DBL_MAX, DBL_MAX};
+    double rhi[3] = {-DBL_MAX, -DBL_MAX, -DBL_MAX};
+    int n = 0;
+
+    for (int b = RAY_BINS - 1; b > 0; b--) {
+        if (counts[b]) grow(rlo, rhi, blo[b], bhi[b]);
+        n += counts[b];
+        right_area[b] = n ? area(rlo, rhi) : 0;
+        right_count[b] = n;
+    }
+
+    double llo[3] = {DBL_MAX, DBL_MAX, DBL_MAX};
+    double lhi[3] = {-DBL_MAX, -DBL_MAX, -DBL_MAX};
+    double best_cost = DBL_MAX;
+    int best = 1;
+
+    n = 0;
+    for (int b = 1; b < RAY_BINS; b++) {
+        if (counts[b - 1]) grow(llo, lhi, blo[b - 1], bhi[b - 1]);
+        n += counts[b - 1];
+        if (!n || !right_count[b]) continue;
+
+        double cost = area(llo, lhi) * n + right_area[b] * right_count[b];
+        if (cost < best_cost) {
+            best_cost = cost;
+            best = b;
+        }
+    }
+
+    // partition order around the chosen boundary
+    int mid = first;
+    for (int i = first; i < first + count; i++) {
+        double * b = bounds[order[i]];
+        int bin = (int) (RAY_BINS * ((b[axis] + b[axis + 3]) / 2 - cmin[axis]) / extent);
+
+        if (bin >= RAY_BINS) bin = RAY_BINS - 1;
+        if (bin < best) {
+            int t = order[i];
+            order[i] = order[mid];
+            order[mid++] = t;
+        }
+    }
+
+    nodes[index].count = 0;
+    build(order, bounds, first, mid - first, depth + 1);
+    int second = build(order, bounds, mid, first + count - mid, depth + 1);
+    nodes[index].start = second;
+    return index;
+}
+
+/*======== void build_hierarchy() ==========
+Builds the nodes over every kept primitive, and reorders the
+primitives so each leaf's are together
+====================*/
+static void build_hierarchy() {
+    int * order = malloc(nprims * sizeof(int));
+    double (*bounds)[6] = malloc(nprims * sizeof(double[6]));
+
+    for (int i = 0; i < nprims; i++) {
+        order[i] = i;
+        prim_bounds(&prims[i], bounds[i], bounds[i] + 3);
+    }
+
+    nnodes = 0;
+    build(order, bounds, 0, nprims, 0);
+
+    struct prim * sorted = malloc(prims_size * sizeof(struct prim));
+    for (int i = 0; i < nprims; i++) sorted[i] = prims[order[i]];
+    free(prims);
+    prims = sorted;
+
+    free(order);
+    free(bounds);
+}
+
+static int hit_box(struct node * n, struct ray * r, double tmax, double * tnear) {
+    double t0 = r -> tmin, t1 = tmax;
+
+    // a ray along a side has a NaN there, which leaves t0 and t1 alone
+    for (int k = 0; k < 3; k++) {
+        double a = (n -> lo[k] - r -> o[k]) * r -> inv[k];
+        double b = (n -> hi[k] - r -> o[k]) * r -> inv[k];
+
+        if (a > b) {
+            double t = a;
+            a = b;
+            b = t;
+        }
+        if (a > t0) t0 = a;
+        if (b < t1) t1 = b;
+    }
+
+    *tnear = t0;
+    return t0 <= t1;
+}
+
+static int hit_prim(struct prim * p, struct ray * r, double tmax, double * t) {
+    double * o = r -> o, * d = r -> d;
+
+    if (p -> type == SPHERE) {
+        double oc[3] = {o[0] - p -> p[0], o[1] - p -> p[1], o[2] - p -> p[2]};
+        double b = dot_product(oc, d);
+        double disc = b * b - (dot_product(oc, oc) - p -> p[3] * p -> p[3]);
+
+        if (disc < 0) return 0;
+
+        // the far side when the ray starts inside
+        double root = sqrt(disc);
+        double near = -b - root;
+        if (near < r -> tmin) near = -b + root;
+        if (near < r -> tmin || near > tmax) return 0;
+
+        *t = near;
+        return 1;
+    }
+
+    // Moller-Trumbore
+    double * a = p -> p;
+    double e1[3] = {a[3] - a[0], a[4] - a[1], a[5] - a[2]};
+    double e2[3] = {a[6] - a[0], a[7] - a[1], a[8] - a[2]};
+    double pv[3] = {d[1] * e2[2] - d[2] * e2[1], d[2] * e2[0] - d[0] * e2[2], d[0] * e2[1] - d[1] * e2[0]};
+    double det = dot_product(e1, pv);
+
+    if (det == 0) return 0;
+
+    double inv = 1 / det;
+    double tv[3] = {o[0] - a[0], o[1] - a[1], o[2] - a[2]};
+    double u = dot_product(tv, pv) * inv;
+
+    if (u < 0 || u > 1) return 0;
+
+    double qv[3] = {tv[1] * e1[2] - tv[2] * e1[1], tv[2] * e1[0] - tv[0] * e1[2], tv[0] * e1[1] - tv[1] * e1[0]};
+    double v = dot_product(d, qv) * inv;
+
+    if (v < 0 || u + v > 1) return 0;
+
+    double hit = dot_product(e2, qv) * inv;
+    if (hit < r -> tmin || hit > tmax) return 0;
+
+    *t = hit;
+    return 1;
+}
+
+/*======== int intersect() ==========
+Inputs:   struct ray * r
+          int any (stop at the first hit found)
+          double * t
+Returns:  The primitive r hits nearest, or any one it hits,
+          or -1, setting t to the distance along r
+====================*/
+static int intersect(struct ray * r, int any, double * t) {
+    int stack[RAY_DEPTH + 2];
+    int top = 0;
+    int found = -1;
+    double tmax = r -> tmax;
+    double tnear;
+
+    if (!hit_box(&nodes[0], r, tmax, &tnear)) return -1;
+    stack[top++] = 0;
+
+    while (top > 0) {
+        struct node * n = &nodes[stack[--top]];
+
+        if (n -> count) {
+            for (int i = n -> start; i < n -> start + n -> count; i++) {
+                double hit;
+
+                if (!hit_prim(&prims[i], r, tmax, &hit)) continue;
+                tmax = hit;
+                found = i;
+                if (any) {
+                    *t = hit;
+                    return i;
+                }
+            }
+            continue;
+        }
+
+        int first = n - nodes + 1, second = n -> start;
+        double t0, t1;
+        int hit0 = hit_box(&nodes[first], r, tmax, &t0);
+        int hit1 = hit_box(&nodes[second], r, tmax, &t1);
+
+        // nearer child on top
+        if (hit0 && hit1 && t0 < t1) {
+            stack[top++] = second;
+            stack[top++] = first;
+        }
+        else {
+            if (hit0) stack[top++] = first;
+            if (hit1) stack[top++] = second;
+        }
+    }
+
+    *t = tmax;
+    return found;
+}
+
+static void set_ray(struct ray * r, double * o, double * d, double tmin, double tmax) {
+    for (int k = 0; k < 3; k++) {
+        r -> o[k] = o[k];
+        r -> d[k] = d[k];
+        r -> inv[k] = 1 / d[k];
+    }
+    r -> tmin = tmin;
+    r -> tmax = tmax;
+}
+
+/*======== color shade() ==========
+Inputs:   struct trace * tr
+          struct ray * r
+          int hit, double t
+          long * shadow (counts the shadow rays)
+Returns:  The color of primitive hit where r meets it
+====================*/
+static color shade(struct trace * tr, struct ray * r, int hit, double t, long * shadow) {
+    struct prim * p = &prims[hit];
+    struct lighting * ls = tr -> prepared[p -> material];
+    double q[3], normal[3];
+
+    for (int k = 0; k < 3; k++) q[k] = r -> o[k] + t * r -> d[k];
+
+    if (p -> type == SPHERE) {
+        for (int k = 0; k < 3; k++) normal[k] = q[k] - p -> p[k];
+    }
+    else {
+        double * a = p -> p;
+        double e1[3] = {a[3] - a[0], a[4] - a[1], a[5] - a[2]};
+        double e2[3] = {a[6] - a[0], a[7] - a[1], a[8] - a[2]};
+
+        normal[0] = e1[1] * e2[2] - e1[2] * e2[1];
+        normal[1] = e1[2] * e2[0] - e1[0] * e2[2];
+        normal[2] = e1[0] * e2[1] - e1[1] * e2[0];
+    }
+
+    // light the side the ray sees
+    normalize(normal);
+    if (dot_product(normal, r -> d) > 0)
+        for (int k = 0; k < 3; k++) normal[k] = -normal[k];
+
+    double o[3];
+    for (int k = 0; k < 3; k++) o[k] = q[k] + RAY_EPSILON * normal[k];
+
+    int hidden = 0;
+    for (int i = 0; i < ls -> count; i++) {
+        double l[3] = {ls -> lx[i], ls -> ly[i], ls -> lz[i]};
+        struct ray sr;
+        double s;
+
+        // lights from behind add nothing anyway, and padding has no light
+        if (ls -> id[i] >= MAX_LIGHTS || dot_product(normal, l) <= 0) continue;
+
+        set_ray(&sr, o, l, 0, DBL_MAX);
+        (*shadow)++;
+        if (intersect(&sr, 1, &s) >= 0) hidden |= 1 << ls -> id[i];
+    }
+
+    return lighting_color_mask(ls, normal, hidden);
+}
+
+static void trace_tile(int index, void * arg) {
+    struct trace * tr = arg;
+    int k = index / tr -> tiles;
+    int tile = index % tr -> tiles;
+    int x0 = tile % tr -> tiles_x * RAY_TILE, y0 = tile / tr -> tiles_x * RAY_TILE;
+    int x1 = x0 + RAY_TILE < XRES ? x0 + RAY_TILE : XRES;
+    int y1 = y0 + RAY_TILE < YRES ? y0 + RAY_TILE : YRES;
+    screen s = tr -> s;
+    zbuffer zb = tr -> zb;
+    double dx = 0, dy = 0;
+    long primary = 0, shadow = 0;
+
+    if (opts.aa > 1) {
+        aa_offset(k, &dx, &dy);
+        s = *aa_screen(k);
+        zb = *aa_zbuffer(k);
+    }
+
+    for (int y = y0; y < y1; y++) {
+        int newy = YRES - 1 - y;
+
+        for (int x = x0; x < x1; x++) {
+            double o[3], d[3], range[2], t;
+            struct ray r;
+
+            camera_ray(x + dx, y + dy, o, d, range);
+            set_ray(&r, o, d, range[0], range[1]);
+            primary++;
+
+            int hit = intersect(&r, 0, &t);
+            if (hit < 0) continue;
+
+            double q[3] = {o[0] + t * d[0], o[1] + t * d[1], o[2] + t * d[2]};
+            float z = camera_depth(q);
+            if (z <= zb[newy][x]) continue;
+
+            zb[newy][x] = z;
+            s[newy][x] = shade(tr, &r, hit, t, &shadow);
+            // lit already, so the G-buffer leaves it be
+            if (opts.deferred) gbuffer[newy][x] = (color) {0, 0, 0};
+        }
+    }
+
+    __atomic_fetch_add(&ray_stats.primary, primary, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&ray_stats.shadow, shadow, __ATOMIC_RELAXED);
+}
+
+/*======== void trace_view() ==========
+Inputs:   screen s
+          zbuffer zb
+          the lighting inputs of draw_polygons
+Traces the screen from the selected camera into s and zb, or
+the sample planes with -a
+====================*/
+static void trace_view(screen s, zbuffer zb,
+                       double * view, struct lights * lights, color ambient) {
+    struct lighting ** prepared = malloc(nmaterials * sizeof(struct lighting *));
+    for (int i = 0; i < nmaterials; i++)
+        prepared[i] = lighting_get(view, lights, ambient, materials[i]);
+
+    struct trace tr = {s, zb, prepared};
+    tr.tiles_x = (XRES + RAY_TILE - 1) / RAY_TILE;
+    tr.tiles = tr.tiles_x * ((YRES + RAY_TILE - 1) / RAY_TILE);
+    pool_run(tr.tiles * aa_count(), trace_tile, &tr);
+
+    if (opts.hiz) hiz_dirty(0, 0, XRES - 1, YRES - 1);
+    free(prepared);
+}
+
+/*======== void ray_flush() ==========
+Inputs:   screen s
+          zbuffer zb
+          the lighting inputs of draw_polygons
+Traces everything kept since the last flush into s and zb,
+and every other view with -v, and forgets it. Goes after
+every raster pass has filled in zb.
+====================*/
+void ray_flush(screen s, zbuffer zb,
+               double * view, struct lights * lights, color ambient) {
+    if (nprims == 0) return;
+
+    double start = now_ms();
+    build_hierarchy();
+    double built = now_ms();
+
+    // one hierarchy for every view, only the rays change
+    for (int k = views_count() - 1; k > 0; k--) {
+        double v[3];
+
+        views_select(k, v);
+        trace_view(*views_screen(k), *views_zbuffer(k), v, lights, ambient);
+    }
+    if (views_count() > 1) views_select(0, NULL);
+
+    trace_view(s, zb, view, lights, ambient);
+
+    ray_stats.primitives += nprims;
+    ray_stats.nodes += nnodes;
+    ray_stats.build_ms += built - start;
+    ray_stats.trace_ms += now_ms() - built;
+
+    nprims = 0;
+    nmaterials = 0;
+}
+
+void ray_print_stats() {
+    double rays = ray_stats.primary + ray_stats.shadow;
+    double rate = ray_stats.trace_ms > 0 ? rays / ray_stats.trace_ms / 1e3 : 0;
+
+    printf("Ray tracing: %ld primitives, %ld nodes built in %.2f ms\n",
+           ray_stats.primitives, ray_stats.nodes, ray_stats.build_ms);
+    printf("Ray tracing: %ld primary and %ld shadow rays in %.2f ms, %.2f Mrays/s on %d threads (%.2f each)\n",
+           ray_stats.primary, ray_stats.shadow, ray_stats.trace_ms,
+           rate, pool_threads(), rate / pool_threads());
+}
@@ -0,0 +1,38 @@
+#ifndef RAY_H
+#define RAY_H
+
+#include "matrix.h"
+#include "ml6.h"
+#include "symtab.h"
+#include "gmath.h"
+
+// Most primitives in a leaf of the hierarchy
+#define RAY_LEAF 4
+// Deepest the hierarchy goes, which bounds the traversal stack
+#define RAY_DEPTH 62
+// Buckets the surface area heuristic tries splits between
+#define RAY_BINS 16
+// Pixels per side of the tiles the screen is traced in
+#define RAY_TILE 16
+// How far shadow rays start off the surface, against it
+// shadowing itself
+#define RAY_EPSILON 1e-3
+
+struct ray_stats {
+    long primitives;
+    long nodes;
+    long primary;
+    long shadow;
+    double build_ms;
+    double trace_ms;
+};
+
+extern struct ray_stats ray_stats;
+
+void ray_shape(int type, double * d, struct matrix * transform,
+               struct constants * reflect, double step);
+void ray_flush(screen s, zbuffer zb,
+               double * view, struct lights * lights, color ambient);
+void ray_print_stats();
+
+#endif
@@ -0,0 +1,195 @@
+/*====================== scan_template.h ========================
+Scanline fill template for the shading modes.
+
+Generates a shade_fn that walks a triangle exactly like
+scanline_convert_clip, and also interpolates SCAN_ATTRS
+values per vertex alongside z, first down the edges and
+then across each span. There's no include guard: a file
+includes this once per fill, defining first
+
+  SCAN_NAME                 the fill's name
+  SCAN_ATTRS                how many values to interpolate
+  SCAN_LOAD(tris, t, i, a)  sets a[] to vertex i of triangle t
+  SCAN_PIXEL(s, zb, x, y, z, a, tris, t)
+                            plots pixel x, y at depth z, with a[]
+                            interpolated there
+
+or, in place of SCAN_PIXEL,
+
+  SCAN_ROW(s, zb, x, xend, y, z, mz, a, ma, tris, t)
+                            fills pixels x up to xend of row y,
+                            starting from z and a[] and adding
+                            mz and ma[] every pixel
+
+all of which are undefined again at the end.
+==================================================*/
+
+#define SCAN_CAT2(a, b) a ## b
+#define SCAN_CAT(a, b) SCAN_CAT2(a, b)
+#define SCAN_SPAN SCAN_CAT(SCAN_NAME, _span)
+
+/*
+  One span of SCAN_NAME, the same as draw_scanline_clip with
+  the attributes stepped like z
+*/
+static void SCAN_SPAN(double x0, double z0, double * a0, double x1, double z1, double * a1,
+                      int y, double offx, screen s, zbuffer zb,
+                      struct triangles * tris, int t, struct rect * clip) {
+    double * al = a0;
+    double * ar = a1;
+
+    if (x0 > x1) {
+        swap(&x0, &x1);
+        swap(&z0, &z1);
+        al = a1;
+        ar = a0;
+    }
+
+    int x = ceil(x0);
+    int xend = ceil(x1);
+
+    double mz = 0;
+    double ma[SCAN_ATTRS];
+    double a[SCAN_ATTRS];
+
+    for (int k = 0; k < SCAN_ATTRS; k++) ma[k] = 0;
+    if ((x1 - x0) > 0) {
+        mz = (z1 - z0) / (x1 - x0);
+        for (int k = 0; k < SCAN_ATTRS; k++) ma[k] = (ar[k] - al[k]) / (x1 - x0);
+    }
+
+    double z = z0 + mz * offx;
+    for (int k = 0; k < SCAN_ATTRS; k++) a[k] = al[k] + ma[k] * offx;
+
+    if (xend > clip -> x1) xend = clip -> x1;
+    while (x < clip -> x0 && x < xend) {
+        z += mz;
+        for (int k = 0; k < SCAN_ATTRS; k++) a[k] += ma[k];
+        x++;
+    }
+
+#ifdef SCAN_ROW
+    SCAN_ROW(s, zb, x, xend, y, z, mz, a, ma, tris, t);
+#else
+    while (x < xend) {
+        SCAN_PIXEL(s, zb, x, y, z, a, tris, t);
+
+        z += mz;
+        for (int k = 0; k < SCAN_ATTRS; k++) a[k] += ma[k];
+        x++;
+    }
+#endif
+}
+
+static void SCAN_NAME(struct matrix * points, struct triangles * tris, int t,
+                      screen s, zbuffer zb, struct rect * clip) {
+    double ** matrix = points -> m;
+    int col = tris -> cols[t];
+    double xv[3], yv[3], zv[3];
+    double av[3][SCAN_ATTRS];
+    int ord[3] = {0, 1, 2};
+
+    for (int i = 0; i < 3; i++) {
+        xv[i] = matrix[0][col + i];
+        yv[i] = matrix[1][col + i];
+        zv[i] = matrix[2][col + i];
+        SCAN_LOAD(tris, t, i, av[i]);
+    }
+
+    // bottom, middle and top, swapped in the same order as scanline_convert_clip
+    if (yv[ord[0]] > yv[ord[1]]) { int i = ord[0]; ord[0] = ord[1]; ord[1] = i; }
+    if (yv[ord[1]] > yv[ord[2]]) { int i = ord[1]; ord[1] = ord[2]; ord[2] = i; }
+    if (yv[ord[0]] > yv[ord[1]]) { int i = ord[0]; ord[0] = ord[1]; ord[1] = i; }
+
+    double xb = xv[ord[0]], xm = xv[ord[1]], xt = xv[ord[2]];
+    double yb = yv[ord[0]], ym = yv[ord[1]], yt = yv[ord[2]];
+    double zb0 = zv[ord[0]], zm = zv[ord[1]], zt = zv[ord[2]];
+    double * ab = av[ord[0]];
+    double * am = av[ord[1]];
+    double * at = av[ord[2]];
+
+    double dist0 = yt - yb;
+    double dist1 = ym - yb;
+    double dist2 = yt - ym;
+
+    double mx0 = dist0 > 0 ? (xt - xb) / dist0 : 0;
+    double mx1 = dist1 > 0 ? (xm - xb) / dist1 : 0;
+    double mx2 = dist2 > 0 ? (xt - xm) / dist2 : 0;
+    double mz0 = dist0 > 0 ? (zt - zb0) / dist0 : 0;
+    double mz1 = dist1 > 0 ? (zm - zb0) / dist1 : 0;
+    double mz2 = dist2 > 0 ? (zt - zm) / dist2 : 0;
+    double ma0[SCAN_ATTRS], ma1[SCAN_ATTRS], ma2[SCAN_ATTRS];
+
+    for (int k = 0; k < SCAN_ATTRS; k++) {
+        ma0[k] = dist0 > 0 ? (at[k] - ab[k]) / dist0 : 0;
+        ma1[k] = dist1 > 0 ? (am[k] - ab[k]) / dist1 : 0;
+        ma2[k] = dist2 > 0 ? (at[k] - am[k]) / dist2 : 0;
+    }
+
+    double offy0 = ceil(yb) - yb;
+    double offy1 = ceil(ym) - ym;
+
+    double x0 = xb + mx0 * offy0;
+    double x1 = xb + mx1 * offy0;
+    double x2 = xm + mx2 * offy1;
+    double z0 = zb0 + mz0 * offy0;
+    double z1 = zb0 + mz1 * offy0;
+    double z2 = zm + mz2 * offy1;
+    double a0[SCAN_ATTRS], a1[SCAN_ATTRS], a2[SCAN_ATTRS];
+
+    for (int k = 0; k < SCAN_ATTRS; k++) {
+        a0[k] = ab[k] + ma0[k] * offy0;
+        a1[k] = ab[k] + ma1[k] * offy0;
+        a2[k] = am[k] + ma2[k] * offy1;
+    }
+
+    int y = ceil(yb);
+    int ytop = ceil(yt);
+
+    if (ytop > clip -> y1) ytop = clip -> y1;
+
+    int toggle = 1;
+    while (y < ytop) {
+        double offx;
+
+        if (y == ceil(ym) && toggle) {
+            x1 = x2;
+            z1 = z2;
+            mx1 = mx2;
+            mz1 = mz2;
+            for (int k = 0; k < SCAN_ATTRS; k++) {
+                a1[k] = a2[k];
+                ma1[k] = ma2[k];
+            }
+
+            toggle = 0;
+        }
+
+        if (y >= clip -> y0) {
+            if (x0 > x1) {
+                offx = ceil(x1) - x1;
+            }
+            else offx = ceil(x0) - x0;
+
+            SCAN_SPAN(x0, z0, a0, x1, z1, a1, y, offx, s, zb, tris, t, clip);
+        }
+        x0 += mx0;
+        x1 += mx1;
+        z0 += mz0;
+        z1 += mz1;
+        for (int k = 0; k < SCAN_ATTRS; k++) {
+            a0[k] += ma0[k];
+            a1[k] += ma1[k];
+        }
+        y++;
+    }
+}
+
+#undef SCAN_SPAN
+#undef SCAN_CAT
+#undef SCAN_CAT2
+#undef SCAN_NAME
+#undef SCAN_ATTRS
+#undef SCAN_LOAD
+#undef SCAN_PIXEL
+#undef SCAN_ROW
@@ -0,0 +1,198 @@
+/*====================== setup.c ========================
+Batched triangle setup.
+
+Turns a polygon matrix into the list of triangles worth
+rasterizing, SETUP_BATCH at a time. Each batch computes
+normals into structure of arrays scratch on the stack,
+drops back facing (and, with -z, occluded) triangles, then
+lights the survivors in straight loops over those arrays.
+The output arrays are kept between calls and only grow,
+so setup does no per triangle heap allocation.
+
+The lighting repeats lighting_color's arithmetic in the same
+order, so colors match the per triangle path exactly. Lights
+are the outer loop, so each pass is still a straight loop
+over the batch, and lights too dim to matter were already
+dropped by lighting_init. The lights come prepared from
+lighting_get, once per material per frame. The specular term
+is only worked out inside a light's highlight, which is a
+small part of the triangles for each light, and then from
+the power table, so outside highlights a triangle costs two
+dot products per light.
+==================================================*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "ml6.h"
+#include "gmath.h"
+#include "matrix.h"
+#include "symtab.h"
+#include "config.h"
+#include "hiz.h"
+#include "gbuffer.h"
+#include "camera.h"
+#include "setup.h"
+
+static struct triangles tris;
+
+/*======== void light_batch() ==========
+Inputs:   struct lighting * ls
+          double * nx, ny, nz
+          int n
+          color * out
+Flat lights n triangles from their (unnormalized) normals,
+one light at a time over the whole batch
+====================*/
+static void light_batch(struct lighting * ls, double * nx, double * ny, double * nz,
+                        int n, color * out) {
+    double diffuse[SETUP_BATCH];
+    double cost[SETUP_BATCH];
+    int c[3][SETUP_BATCH];
+
+    for (int k = 0; k < n; k++) {
+        double mag = sqrt(nx[k] * nx[k] + ny[k] * ny[k] + nz[k] * nz[k]);
+        nx[k] = nx[k] / mag;
+        ny[k] = ny[k] / mag;
+        nz[k] = nz[k] / mag;
+    }
+
+    for (int k = 0; k < n; k++) {
+        double t = nx[k] * ls -> v[0] + ny[k] * ls -> v[1] + nz[k] * ls -> v[2];
+        cost[k] = t < 0 ? 0 : t;
+
+        for (int i = 0; i < 3; i++) c[i][k] = ls -> a[i];
+    }
+
+    for (int j = 0; j < ls -> count; j++) {
+        double lx = ls -> lx[j], ly = ls -> ly[j], lz = ls -> lz[j];
+
+        for (int k = 0; k < n; k++) {
+            double d = nx[k] * lx + ny[k] * ly + nz[k] * lz;
+            diffuse[k] = d < 0 ? 0 : d;
+        }
+
+        // each term truncates on its own, like in lighting_color
+        for (int i = 0; i < 3; i++)
+            for (int k = 0; k < n; k++)
+                c[i][k] += (unsigned short) (ls -> kd[i][j] * diffuse[k]);
+
+        double smin2 = ls -> smin[j] * ls -> smin[j];
+
+        for (int k = 0; k < n; k++) {
+            double rx = 2 * nx[k] * cost[k] - lx;
+            double ry = 2 * ny[k] * cost[k] - ly;
+            double rz = 2 * nz[k] * cost[k] - lz;
+            double mag2 = rx * rx + ry * ry + rz * rz;
+            double rv = rx * ls -> v[0] + ry * ls -> v[1] + rz * ls -> v[2];
+
+            // outside the highlight the term truncates to 0 anyway
+            if (rv <= 0 || rv * rv < smin2 * mag2) continue;
+
+            double mag = sqrt(mag2);
+            rx = rx / mag;
+            ry = ry / mag;
+            rz = rz / mag;
+
+            double r = rx * ls -> v[0] + ry * ls -> v[1] + rz * ls -> v[2];
+            int sp[3] = {0, 0, 0};
+
+            if (r <= 0) continue;
+            specular_terms(ls, j, r, sp);
+            c[RED][k] += sp[RED];
+            c[GREEN][k] += sp[GREEN];
+            c[BLUE][k] += sp[BLUE];
+        }
+    }
+
+    for (int k = 0; k < n; k++) {
+        out[k].red = c[RED][k] > 255 ? 255 : c[RED][k];
+        out[k].green = c[GREEN][k] > 255 ? 255 : c[GREEN][k];
+        out[k].blue = c[BLUE][k] > 255 ? 255 : c[BLUE][k];
+        out[k].alpha = MAX_COLOR;
+    }
+}
+
+/*======== struct triangles * setup_triangles() ==========
+Inputs:   struct matrix * polygons
+          the lighting inputs of draw_polygons
+Returns:  The front facing, unoccluded triangles of polygons
+          and their colors. The result is reused by the next
+          call.
+With -z the caller brings the HiZ pyramid up to date first.
+With -e the colors are left for the prepass to fill in.
+====================*/
+struct triangles * setup_triangles( struct matrix * polygons,
+                                    double * view, struct lights * lights, color ambient,
+                                    struct constants * reflect) {
+    double ** m = polygons -> m;
+    double * normals = camera_normals(polygons);
+    int ntris = polygons -> lastcol / 3;
+    struct lighting * ls = NULL;
+
+    if (ntris > tris.size) {
+        tris.size = ntris;
+        tris.cols = realloc(tris.cols, tris.size * sizeof(int));
+        tris.colors = realloc(tris.colors, tris.size * sizeof(color));
+    }
+    tris.count = 0;
+
+    if (!opts.deferred && !opts.prepass) ls = lighting_get(view, lights, ambient, reflect);
+
+    for (int base = 0; base < ntris; base += SETUP_BATCH) {
+        int n = ntris - base < SETUP_BATCH ? ntris - base : SETUP_BATCH;
+        double nx[SETUP_BATCH], ny[SETUP_BATCH], nz[SETUP_BATCH];
+        int kept = 0;
+
+        for (int k = 0; k < n; k++) {
+            int col = 3 * (base + k);
+            double ax = m[0][col + 1] - m[0][col];
+            double ay = m[1][col + 1] - m[1][col];
+            double az = m[2][col + 1] - m[2][col];
+            double bx = m[0][col + 2] - m[0][col];
+            double by = m[1][col + 2] - m[1][col];
+            double bz = m[2][col + 2] - m[2][col];
+
+            nx[k] = ay * bz - az * by;
+            ny[k] = az * bx - ax * bz;
+            nz[k] = ax * by - ay * bx;
+        }
+
+        // compact the survivors to the front of the batch
+        for (int k = 0; k < n; k++) {
+            int col = 3 * (base + k);
+
+            if (nz[k] <= 0) continue;
+            if (opts.hiz && hiz_triangle_occluded(polygons, col)) continue;
+
+            nx[kept] = nx[k];
+            ny[kept] = ny[k];
+            nz[kept] = nz[k];
+            tris.cols[tris.count + kept] = col;
+            kept++;
+        }
+
+        // facing is decided on the screen, but perspective bends those normals
+        if (normals) {
+            for (int k = 0; k < kept; k++) {
+                double * n = normals + tris.cols[tris.count + k];
+                nx[k] = n[0];
+                ny[k] = n[1];
+                nz[k] = n[2];
+            }
+        }
+
+        if (opts.deferred) {
+            for (int k = 0; k < kept; k++) {
+                double normal[3] = {nx[k], ny[k], nz[k]};
+                tris.colors[tris.count + k] = gbuffer_surface(normal, view, ambient, lights, reflect);
+            }
+        }
+        else if (!opts.prepass) light_batch(ls, nx, ny, nz, kept, tris.colors + tris.count);
+
+        tris.count += kept;
+    }
+
+    return &tris;
+}
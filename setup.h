@@ -0,0 +1,32 @@
+#ifndef SETUP_H
+#define SETUP_H
+
+#include "matrix.h"
+#include "ml6.h"
+#include "symtab.h"
+#include "gmath.h"
+
+// Triangles set up together, sized so a batch stays in L1
+#define SETUP_BATCH 64
+
+/*
+  The triangles of a polygon matrix that survive setup, in
+  submission order: the column each starts at and its flat
+  color (a surface id in deferred mode), or for Gouraud
+  shading the colors of its three vertices, or for Phong
+  their normals.
+*/
+struct triangles {
+    int count;
+    int * cols;
+    color * colors;
+    color * vcolors;
+    double * vnormals;
+    int size;
+};
+
+struct triangles * setup_triangles( struct matrix * polygons,
+                                    double * view, struct lights * lights, color ambient,
+                                    struct constants * reflect);
+
+#endif
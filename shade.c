@@ -0,0 +1,119 @@
+/*====================== shade.c ========================
+Shading mode kernels.
+
+Each filled shading mode is a triangle setup, which does
+the lighting it needs, and a fill that interpolates what
+the setup produced. shader_select hands draw_polygons the
+pair for the current mode and raster kernel, so the inner
+loops are specialized ahead of time instead of branching
+on the mode per triangle or per pixel.
+
+The flat fills are generated from the raster kernels by
+FLAT_FILL, which only looks up the triangle's column and
+color, so each is the same loop it always was. Fills that
+interpolate more than depth are generated from
+scan_template.h, whatever the raster kernel.
+==================================================*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "ml6.h"
+#include "draw.h"
+#include "display.h"
+#include "matrix.h"
+#include "config.h"
+#include "edge.h"
+#include "fixed.h"
+#include "setup.h"
+#include "gouraud.h"
+#include "phong.h"
+#include "shade.h"
+
+#define FLAT_FILL(name, convert)                                            \
+static void name(struct matrix * points, struct triangles * tris, int t,   \
+                 screen s, zbuffer zb, struct rect * clip) {                \
+    convert(points, tris -> cols[t], s, zb, tris -> colors[t], clip);       \
+}
+
+FLAT_FILL(flat_scanline, scanline_convert_clip)
+FLAT_FILL(flat_edge, edge_convert_clip)
+FLAT_FILL(flat_fixed, fixed_convert_clip)
+
+// Vertex colors from setup_gouraud, interpolated per pixel
+#define SCAN_NAME gouraud_fill
+#define SCAN_ATTRS 3
+#define SCAN_LOAD(tris, t, i, a) {                  \
+    color vc = (tris) -> vcolors[3 * (t) + (i)];    \
+    (a)[0] = vc.red;                                \
+    (a)[1] = vc.green;                              \
+    (a)[2] = vc.blue;                               \
+}
+#define SCAN_PIXEL(s, zb, x, y, z, a, tris, t) {    \
+    color pc;                                       \
+    pc.red = (a)[0] + 0.5;                          \
+    pc.green = (a)[1] + 0.5;                        \
+    pc.blue = (a)[2] + 0.5;                         \
+    pc.alpha = MAX_COLOR;                           \
+    plot(s, zb, pc, x, y, z);                       \
+}
+#include "scan_template.h"
+
+// Normals from setup_phong, interpolated and lit per visible pixel
+#define SCAN_NAME phong_fill
+#define SCAN_ATTRS 3
+#define SCAN_LOAD(tris, t, i, a) {                          \
+    double * vn = (tris) -> vnormals + 9 * (t) + 3 * (i);   \
+    (a)[0] = vn[0];                                         \
+    (a)[1] = vn[1];                                         \
+    (a)[2] = vn[2];                                         \
+}
+#define SCAN_ROW(s, zb, x, xend, y, z, mz, a, ma, tris, t)  \
+    phong_span(s, zb, x, xend, y, z, mz, a, ma)
+#include "scan_template.h"
+
+/*======== shade_fn flat_fill() ==========
+Returns:  The flat fill for the raster kernel selected on
+          the command line
+====================*/
+static shade_fn flat_fill() {
+    switch (opts.raster) {
+        case RASTER_EDGE:
+            edge_init();
+            return flat_edge;
+
+        case RASTER_FIXED:
+            return flat_fixed;
+
+        default:
+            return flat_scanline;
+    }
+}
+
+/*======== struct shader shader_select() ==========
+Inputs:   int mode
+Returns:  The setup and fill kernels of a filled shading
+          mode
+====================*/
+struct shader shader_select(int mode) {
+    struct shader sh;
+
+    // shading_type already made these flat where they can't interpolate
+    switch (mode) {
+        case SHADE_GOURAUD:
+            sh.setup = setup_gouraud;
+            sh.fill = gouraud_fill;
+            break;
+
+        case SHADE_PHONG:
+            sh.setup = setup_phong;
+            sh.fill = phong_fill;
+            break;
+
+        default:
+            sh.setup = setup_triangles;
+            sh.fill = flat_fill();
+    }
+    return sh;
+}
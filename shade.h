@@ -0,0 +1,31 @@
+#ifndef SHADE_H
+#define SHADE_H
+
+#include "matrix.h"
+#include "ml6.h"
+#include "symtab.h"
+#include "draw.h"
+#include "setup.h"
+
+// Fills triangle t of a setup, inside clip
+typedef void (*shade_fn)(struct matrix * points, struct triangles * tris, int t,
+                         screen s, zbuffer zb, struct rect * clip);
+
+// Turns a polygon matrix into the triangles a shade_fn fills
+typedef struct triangles * (*setup_fn)( struct matrix * polygons,
+                                        double * view, struct lights * lights, color ambient,
+                                        struct constants * reflect);
+
+/*
+  The kernels of one filled shading mode. draw_polygons
+  picks them once per draw, so nothing below it tests the
+  mode again.
+*/
+struct shader {
+    setup_fn setup;
+    shade_fn fill;
+};
+
+struct shader shader_select(int mode);
+
+#endif
@@ -0,0 +1,318 @@
+/*====================== shadow.c ========================
+Shadow maps for the script's lights.
+
+With -m every sphere, torus and box command is also recorded
+as a caster, with a copy of the stack matrix, the same way
+-o queues them. Before the G-buffer is lit, shadow_update
+gives each light a depth map: the casters are tessellated
+and rasterized looking down the light, which, like every
+light here, is a direction. Each texel keeps the depth of
+the caster nearest the light, and gbuffer_resolve leaves
+out the lights a pixel is hidden from.
+
+A map is only rendered again when what it was rendered from
+changes. Each one is keyed by a hash of its light and every
+caster's command, numbers, matrix and step. In an animation
+a knob that only moves the camera side of things, or
+nothing that casts, leaves the key alone, and the map from
+the last frame is reused as is.
+
+The map covers exactly the casters' extent, so a point
+outside it can't be shadowed by anything. A surface facing
+away from a light is in its shadow by definition.
+==================================================*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <float.h>
+#include <math.h>
+
+#include "ml6.h"
+#include "draw.h"
+#include "gmath.h"
+#include "matrix.h"
+#include "order.h"
+#include "pool.h"
+#include "shadow.h"
+
+struct caster {
+    int type;
+    double d[6];
+    double m[4][4];
+    double step;
+};
+
+struct shadow_map {
+    int valid;
+    unsigned long long key;
+    double u[3], v[3], w[3];    // light space, w points at the light
+    double s0, t0;              // light space corner of texel 0
+    double scale;               // texels per pixel
+    double * depth;
+};
+
+struct shadow_stats shadow_stats;
+
+static struct caster * casters = NULL;
+static int ncasters = 0;
+static int casters_size = 0;
+static unsigned long long casters_hash;
+
+static struct shadow_map maps[MAX_LIGHTS];
+static int nmaps = 0;
+
+// The casters' triangles, 9 coordinates each, while rendering
+static double * tris = NULL;
+static int ntris = 0;
+static int tris_size = 0;
+
+static unsigned long long hash_bytes(unsigned long long h, void * p, int n) {
+    unsigned char * b = p;
+
+    for (int i = 0; i < n; i++) {
+        h ^= b[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+/*======== void shadow_clear() ==========
+Forgets the casters, to go with clear_zbuffer. The maps
+stay, for the next frame to reuse.
+====================*/
+void shadow_clear() {
+    ncasters = 0;
+    casters_hash = 14695981039346656037ULL;
+}
+
+/*======== void shadow_caster() ==========
+Inputs:   int type (ORDER_SPHERE, ORDER_TORUS or ORDER_BOX)
+          double * d (the command's numbers, as add_* takes them)
+          struct matrix * transform
+          double step
+Records a shape that casts shadows
+====================*/
+void shadow_caster(int type, double * d, struct matrix * transform, double step) {
+    if (ncasters == casters_size) {
+        casters_size = casters_size ? casters_size * 2 : 64;
+        casters = realloc(casters, casters_size * sizeof(struct caster));
+    }
+
+    struct caster * c = &casters[ncasters++];
+
+    memset(c, 0, sizeof(struct caster));
+    c -> type = type;
+    memcpy(c -> d, d, sizeof(c -> d));
+    for (int i = 0; i < 4; i++)
+        for (int j = 0; j < 4; j++)
+            c -> m[i][j] = transform -> m[i][j];
+    c -> step = step;
+
+    casters_hash = hash_bytes(casters_hash, c, sizeof(struct caster));
+    shadow_stats.casters++;
+}
+
+/*======== void add_casters() ==========
+Tessellates every caster into tris
+====================*/
+static void add_casters() {
+    struct matrix * temp = new_matrix(4, 1000);
+    struct matrix * transform = new_matrix(4, 4);
+
+    ntris = 0;
+    for (int i = 0; i < ncasters; i++) {
+        struct caster * c = &casters[i];
+        double * d = c -> d;
+
+        if (c -> type == ORDER_SPHERE) add_sphere(temp, d[0], d[1], d[2], d[3], c -> step);
+        else if (c -> type == ORDER_TORUS) add_torus(temp, d[0], d[1], d[2], d[3], d[4], c -> step);
+        else add_box(temp, d[0], d[1], d[2], d[3], d[4], d[5]);
+
+        for (int r = 0; r < 4; r++)
+            for (int k = 0; k < 4; k++)
+                transform -> m[r][k] = c -> m[r][k];
+        transform -> lastcol = 4;
+        matrix_mult(transform, temp);
+
+        int n = temp -> lastcol / 3;
+        if (ntris + n > tris_size) {
+            while (ntris + n > tris_size) tris_size = tris_size ? tris_size * 2 : 4096;
+            tris = realloc(tris, tris_size * 9 * sizeof(double));
+        }
+        for (int t = 0; t < n; t++)
+            for (int v = 0; v < 3; v++)
+                for (int k = 0; k < 3; k++)
+                    tris[9 * (ntris + t) + 3 * v + k] = temp -> m[k][3 * t + v];
+        ntris += n;
+        temp -> lastcol = 0;
+    }
+
+    free_matrix(temp);
+    free_matrix(transform);
+}
+
+static void map_basis(struct shadow_map * sm, double * l) {
+    double a[3] = {1, 0, 0};
+
+    memcpy(sm -> w, l, sizeof(sm -> w));
+    normalize(sm -> w);
+    if (fabs(sm -> w[0]) > 0.9) {
+        a[0] = 0;
+        a[1] = 1;
+    }
+
+    sm -> u[0] = a[1] * sm -> w[2] - a[2] * sm -> w[1];
+    sm -> u[1] = a[2] * sm -> w[0] - a[0] * sm -> w[2];
+    sm -> u[2] = a[0] * sm -> w[1] - a[1] * sm -> w[0];
+    normalize(sm -> u);
+
+    sm -> v[0] = sm -> w[1] * sm -> u[2] - sm -> w[2] * sm -> u[1];
+    sm -> v[1] = sm -> w[2] * sm -> u[0] - sm -> w[0] * sm -> u[2];
+    sm -> v[2] = sm -> w[0] * sm -> u[1] - sm -> w[1] * sm -> u[0];
+}
+
+/*======== void render_map() ==========
+Inputs:   int index
+          void * arg (the maps to render)
+Fits one map around the casters and fills it with their
+depths toward the light. A texel belongs to a triangle when
+its center is inside or on an edge, so neighbors overlap
+rather than leave cracks.
+====================*/
+static void render_map(int index, void * arg) {
+    struct shadow_map * sm = ((struct shadow_map **) arg)[index];
+    double smin = DBL_MAX, smax = -DBL_MAX, tmin = DBL_MAX, tmax = -DBL_MAX;
+
+    for (int i = 0; i < 3 * ntris; i++) {
+        double s = dot_product(tris + 3 * i, sm -> u);
+        double t = dot_product(tris + 3 * i, sm -> v);
+
+        smin = fmin(smin, s);
+        smax = fmax(smax, s);
+        tmin = fmin(tmin, t);
+        tmax = fmax(tmax, t);
+    }
+
+    // a texel of margin all around
+    double range = fmax(fmax(smax - smin, tmax - tmin), 1);
+    sm -> scale = (SHADOW_RES - 2) / range;
+    sm -> s0 = smin - 1 / sm -> scale;
+    sm -> t0 = tmin - 1 / sm -> scale;
+
+    if (!sm -> depth) sm -> depth = malloc(SHADOW_RES * SHADOW_RES * sizeof(double));
+    for (int i = 0; i < SHADOW_RES * SHADOW_RES; i++) sm -> depth[i] = -DBL_MAX;
+
+    for (int t = 0; t < ntris; t++) {
+        double x[3], y[3], z[3];
+
+        for (int v = 0; v < 3; v++) {
+            double * p = tris + 9 * t + 3 * v;
+
+            x[v] = (dot_product(p, sm -> u) - sm -> s0) * sm -> scale;
+            y[v] = (dot_product(p, sm -> v) - sm -> t0) * sm -> scale;
+            z[v] = dot_product(p, sm -> w);
+        }
+
+        double area = (x[1] - x[0]) * (y[2] - y[0]) - (x[2] - x[0]) * (y[1] - y[0]);
+        if (area == 0) continue;
+
+        int x0 = floor(fmin(x[0], fmin(x[1], x[2])));
+        int x1 = ceil(fmax(x[0], fmax(x[1], x[2])));
+        int y0 = floor(fmin(y[0], fmin(y[1], y[2])));
+        int y1 = ceil(fmax(y[0], fmax(y[1], y[2])));
+
+        if (x0 < 0) x0 = 0;
+        if (y0 < 0) y0 = 0;
+        if (x1 > SHADOW_RES - 1) x1 = SHADOW_RES - 1;
+        if (y1 > SHADOW_RES - 1) y1 = SHADOW_RES - 1;
+
+        for (int j = y0; j <= y1; j++) {
+            double py = j + 0.5;
+
+            for (int i = x0; i <= x1; i++) {
+                double px = i + 0.5;
+                double b0 = ((x[1] - px) * (y[2] - py) - (x[2] - px) * (y[1] - py)) / area;
+                double b1 = ((x[2] - px) * (y[0] - py) - (x[0] - px) * (y[2] - py)) / area;
+                double b2 = 1 - b0 - b1;
+
+                if (b0 < 0 || b1 < 0 || b2 < 0) continue;
+
+                double d = b0 * z[0] + b1 * z[1] + b2 * z[2];
+                if (d > sm -> depth[j * SHADOW_RES + i]) sm -> depth[j * SHADOW_RES + i] = d;
+            }
+        }
+    }
+}
+
+/*======== void shadow_update() ==========
+Inputs:   struct lights * lights
+Brings a map for every light up to date with the casters
+recorded so far, rendering the ones whose key changed in
+parallel on the worker pool
+====================*/
+void shadow_update(struct lights * lights) {
+    struct shadow_map * todo[MAX_LIGHTS];
+    int n = 0;
+
+    nmaps = lights -> count;
+    for (int j = 0; j < nmaps; j++) {
+        double l[3] = {lights -> x[j], lights -> y[j], lights -> z[j]};
+        unsigned long long key = hash_bytes(casters_hash, l, sizeof(l));
+
+        if (maps[j].valid && maps[j].key == key) {
+            shadow_stats.hits++;
+            continue;
+        }
+
+        shadow_stats.misses++;
+        maps[j].valid = 1;
+        maps[j].key = key;
+        map_basis(&maps[j], l);
+        todo[n++] = &maps[j];
+    }
+
+    if (n == 0) return;
+
+    add_casters();
+    pool_run(n, render_map, todo);
+}
+
+/*======== int shadow_mask() ==========
+Inputs:   double x, y, z (a pixel and its depth)
+          double * normal (not necessarily unit)
+Returns:  A bit for every light the point is hidden from
+The depth slack grows with the slope of the surface to the
+light, since one texel spans more depth on a slanted one.
+====================*/
+int shadow_mask(double x, double y, double z, double * normal) {
+    double p[3] = {x, y, z};
+    double len = sqrt(dot_product(normal, normal));
+    int mask = 0;
+
+    for (int j = 0; j < nmaps; j++) {
+        struct shadow_map * sm = &maps[j];
+        double c = dot_product(normal, sm -> w) / len;
+
+        if (!(c > 0)) {
+            mask |= 1 << j;
+            continue;
+        }
+
+        int i = floor((dot_product(p, sm -> u) - sm -> s0) * sm -> scale);
+        int k = floor((dot_product(p, sm -> v) - sm -> t0) * sm -> scale);
+        if (i < 0 || k < 0 || i >= SHADOW_RES || k >= SHADOW_RES) continue;
+
+        double slope = fmin(sqrt(1 - c * c) / c, SHADOW_MAX_SLOPE);
+        double bias = (SHADOW_BIAS + slope) / sm -> scale;
+
+        if (sm -> depth[k * SHADOW_RES + i] > dot_product(p, sm -> w) + bias)
+            mask |= 1 << j;
+    }
+    return mask;
+}
+
+void shadow_print_stats() {
+    printf("Shadows: %ld casters, %ld maps reused, %ld rendered\n",
+           shadow_stats.casters, shadow_stats.hits, shadow_stats.misses);
+}
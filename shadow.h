@@ -0,0 +1,29 @@
+#ifndef SHADOW_H
+#define SHADOW_H
+
+#include "matrix.h"
+#include "ml6.h"
+#include "gmath.h"
+
+// Texels per side of a shadow map
+#define SHADOW_RES 1024
+// Depth slack, in texels, against a surface shadowing itself
+#define SHADOW_BIAS 1.5
+// Most texels of slack on surfaces nearly edge on to a light
+#define SHADOW_MAX_SLOPE 8
+
+struct shadow_stats {
+    long casters;
+    long hits;
+    long misses;
+};
+
+extern struct shadow_stats shadow_stats;
+
+void shadow_clear();
+void shadow_caster(int type, double * d, struct matrix * transform, double step);
+void shadow_update(struct lights * lights);
+int shadow_mask(double x, double y, double z, double * normal);
+void shadow_print_stats();
+
+#endif
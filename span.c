@@ -0,0 +1,385 @@
+/*====================== span.c ========================
+Span buffer hidden surface removal.
+
+With -s, filled triangles don't touch the zbuffer. Each
+scanline keeps a list of spans sorted by x that never
+overlap, and every span draw_scanline would have drawn is
+inserted into its row instead. Where the new span overlaps
+one already there, the two depth lines are compared over
+the overlap: the nearer one keeps those pixels, and if the
+lines cross the overlap is split at the first pixel where
+the other is nearer. As in the zbuffer a tie goes to what
+was drawn first.
+
+A span is just its ends, the depth at its left end and the
+depth step, so a row of a big flat box face is one entry
+instead of hundreds of doubles. span_resolve writes the
+rows out once per frame, testing each pixel against the
+zbuffer, which is how anything drawn directly (lines,
+wireframes, impostors) composites with them.
+
+Depth is evaluated from the left end rather than added up
+pixel by pixel, so where two surfaces are within rounding
+of each other a pixel can go the other way from the
+zbuffer path.
+==================================================*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "ml6.h"
+#include "draw.h"
+#include "matrix.h"
+#include "setup.h"
+#include "span.h"
+
+struct span {
+    int x0, x1;     // pixels x0 up to, not including, x1
+    double z;       // depth at x0
+    double mz;      // depth step per pixel
+    color c;
+};
+
+struct span_row {
+    struct span * spans;
+    int n;
+    int size;
+};
+
+// How close two planes must be to merge their spans
+#define SPAN_EPSILON 1e-9
+
+struct span_stats span_stats;
+
+static struct span_row * rows = NULL;
+static long nspans = 0;
+
+// The part of a row being rebuilt by span_insert
+static struct span_row scratch;
+
+static double span_depth(struct span * sp, int x) {
+    return sp -> z + sp -> mz * (x - sp -> x0);
+}
+
+static int same_color(color a, color b) {
+    return a.red == b.red && a.green == b.green && a.blue == b.blue;
+}
+
+/*======== void push_piece() ==========
+Inputs:   struct span_row * row
+          struct span * sp
+          int x0, x1
+Appends the part of sp from x0 to x1 to row, extending the
+last span instead when sp carries on from it
+====================*/
+static void push_piece(struct span_row * row, struct span * sp, int x0, int x1) {
+    if (x0 >= x1) return;
+
+    double z = span_depth(sp, x0);
+
+    // continues the last span on the same plane, like the other half of a box face
+    if (row -> n) {
+        struct span * last = &row -> spans[row -> n - 1];
+
+        if (last -> x1 == x0 && same_color(last -> c, sp -> c)
+            && fabs(last -> mz - sp -> mz) <= SPAN_EPSILON
+            && fabs(span_depth(last, x0) - z) <= SPAN_EPSILON * (1 + fabs(z))) {
+            last -> x1 = x1;
+            return;
+        }
+    }
+
+    if (row -> n == row -> size) {
+        row -> size = row -> size ? row -> size * 2 : 16;
+        row -> spans = realloc(row -> spans, row -> size * sizeof(struct span));
+    }
+
+    struct span * p = &row -> spans[row -> n++];
+    p -> x0 = x0;
+    p -> x1 = x1;
+    p -> z = z;
+    p -> mz = sp -> mz;
+    p -> c = sp -> c;
+}
+
+/*======== void resolve_overlap() ==========
+Inputs:   struct span_row * row
+          struct span * new
+          struct span * old
+          int l, r
+Appends whichever of new and old is visible at each pixel
+from l to r. The difference of two depth lines is a line,
+so new is nearer over a single run at one end at most.
+====================*/
+static void resolve_overlap(struct span_row * row, struct span * new, struct span * old,
+                            int l, int r) {
+    double fl = span_depth(new, l) - span_depth(old, l);
+    double fr = span_depth(new, r - 1) - span_depth(old, r - 1);
+
+    if (fl > 0 && fr > 0) {
+        push_piece(row, new, l, r);
+        return;
+    }
+    if (fl <= 0 && fr <= 0) {
+        push_piece(row, old, l, r);
+        return;
+    }
+
+    // first pixel on the other side of the crossing, estimated then fixed up
+    int xc = l + (int) ceil(fl / (fl - fr) * (r - 1 - l));
+    int nearer_left = fl > 0;
+
+    if (xc < l + 1) xc = l + 1;
+    if (xc > r - 1) xc = r - 1;
+    while (xc > l + 1 && (span_depth(new, xc - 1) - span_depth(old, xc - 1) > 0) != nearer_left)
+        xc--;
+    while (xc < r - 1 && (span_depth(new, xc) - span_depth(old, xc) > 0) == nearer_left)
+        xc++;
+
+    span_stats.split++;
+    push_piece(row, nearer_left ? new : old, l, xc);
+    push_piece(row, nearer_left ? old : new, xc, r);
+}
+
+/*======== void span_insert() ==========
+Inputs:   int y
+          struct span * new
+Merges new into row y. Only the spans it overlaps, and one
+on either side so pieces can join up with them, are rebuilt
+in scratch and spliced back in.
+====================*/
+static void span_insert(int y, struct span * new) {
+    struct span_row * row = &rows[y];
+    struct span * spans = row -> spans;
+    int cur = new -> x0;
+    int end = new -> x1;
+
+    span_stats.inserted++;
+    scratch.n = 0;
+
+    // first span ending past the start of new
+    int lo = 0, hi = row -> n;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (spans[mid].x1 > cur) hi = mid;
+        else lo = mid + 1;
+    }
+    int first = lo > 0 ? lo - 1 : 0;
+    int last = lo;
+    while (last < row -> n && spans[last].x0 < end) last++;
+    if (last < row -> n) last++;
+
+    for (int i = first; i < last; i++) {
+        struct span * old = &spans[i];
+
+        // entirely left of what's left of new, or new is done
+        if (old -> x1 <= cur || cur >= end) {
+            push_piece(&scratch, old, old -> x0, old -> x1);
+            continue;
+        }
+
+        // entirely right of new
+        if (old -> x0 >= end) {
+            push_piece(&scratch, new, cur, end);
+            cur = end;
+            push_piece(&scratch, old, old -> x0, old -> x1);
+            continue;
+        }
+
+        if (old -> x0 > cur) {
+            push_piece(&scratch, new, cur, old -> x0);
+            cur = old -> x0;
+        }
+        else push_piece(&scratch, old, old -> x0, cur);
+
+        int r = old -> x1 < end ? old -> x1 : end;
+        resolve_overlap(&scratch, new, old, cur, r);
+        cur = r;
+        push_piece(&scratch, old, r, old -> x1);
+    }
+    push_piece(&scratch, new, cur, end);
+
+    int n = row -> n - (last - first) + scratch.n;
+    if (n > row -> size) {
+        while (n > row -> size) row -> size = row -> size ? row -> size * 2 : 16;
+        row -> spans = realloc(row -> spans, row -> size * sizeof(struct span));
+        spans = row -> spans;
+    }
+    memmove(&spans[first + scratch.n], &spans[last], (row -> n - last) * sizeof(struct span));
+    memcpy(&spans[first], scratch.spans, scratch.n * sizeof(struct span));
+
+    nspans += n - row -> n;
+    if (nspans > span_stats.peak) span_stats.peak = nspans;
+    row -> n = n;
+}
+
+/*======== void span_scanline() ==========
+draw_scanline, inserting the span clipped to the screen
+====================*/
+static void span_scanline(double x0, double z0, double x1, double z1, int y, double offx,
+                          color c) {
+    if (x0 > x1) {
+        swap(&x0, &x1);
+        swap(&z0, &z1);
+    }
+
+    struct span sp;
+    double mz = 0;
+    if ((x1 - x0) > 0) {
+        mz = (z1 - z0) / (x1 - x0);
+    }
+
+    sp.x0 = ceil(x0);
+    sp.x1 = ceil(x1);
+    sp.z = z0 + mz * offx;
+    sp.mz = mz;
+    sp.c = c;
+
+    if (sp.x1 > XRES) sp.x1 = XRES;
+    if (sp.x0 < 0) {
+        sp.z = span_depth(&sp, 0);
+        sp.x0 = 0;
+    }
+    if (sp.x0 >= sp.x1) return;
+
+    span_insert(y, &sp);
+}
+
+/*======== void span_convert() ==========
+scanline_convert, inserting spans instead of plotting
+====================*/
+static void span_convert(struct matrix * points, int col, color c) {
+    double ** matrix = points -> m;
+    double xb = matrix[0][col];
+    double xm = matrix[0][col + 1];
+    double xt = matrix[0][col + 2];
+    double yb = matrix[1][col];
+    double ym = matrix[1][col + 1];
+    double yt = matrix[1][col + 2];
+    double zb = matrix[2][col];
+    double zm = matrix[2][col + 1];
+    double zt = matrix[2][col + 2];
+
+    if (yb > ym) {
+        swap(&yb, &ym);
+        swap(&xb, &xm);
+        swap(&zb, &zm);
+    }
+    if (ym > yt) {
+        swap(&ym, &yt);
+        swap(&xm, &xt);
+        swap(&zm, &zt);
+    }
+    if (yb > ym) {
+        swap(&yb, &ym);
+        swap(&xb, &xm);
+        swap(&zb, &zm);
+    }
+
+    double dist0 = yt - yb;
+    double dist1 = ym - yb;
+    double dist2 = yt - ym;
+
+    double mx0 = dist0 > 0 ? (xt - xb) / dist0 : 0;
+    double mx1 = dist1 > 0 ? (xm - xb) / dist1 : 0;
+    double mx2 = dist2 > 0 ? (xt - xm) / dist2 : 0;
+    double mz0 = dist0 > 0 ? (zt - zb) / dist0 : 0;
+    double mz1 = dist1 > 0 ? (zm - zb) / dist1 : 0;
+    double mz2 = dist2 > 0 ? (zt - zm) / dist2 : 0;
+
+    double offy0 = ceil(yb) - yb;
+    double offy1 = ceil(ym) - ym;
+
+    double x0 = xb + mx0 * offy0;
+    double x1 = xb + mx1 * offy0;
+    double x2 = xm + mx2 * offy1;
+    double z0 = zb + mz0 * offy0;
+    double z1 = zb + mz1 * offy0;
+    double z2 = zm + mz2 * offy1;
+    int y = ceil(yb);
+    int ytop = ceil(yt);
+
+    if (ytop > YRES) ytop = YRES;
+
+    int toggle = 1;
+    while (y < ytop) {
+        double offx;
+
+        if (y == ceil(ym) && toggle) {
+            x1 = x2;
+            z1 = z2;
+            mx1 = mx2;
+            mz1 = mz2;
+
+            toggle = 0;
+        }
+
+        if (y >= 0) {
+            if (x0 > x1) {
+                offx = ceil(x1) - x1;
+            }
+            else offx = ceil(x0) - x0;
+
+            span_scanline(x0, z0, x1, z1, y, offx, c);
+        }
+        x0 += mx0;
+        x1 += mx1;
+        z0 += mz0;
+        z1 += mz1;
+        y++;
+    }
+}
+
+/*======== void span_clear() ==========
+Empties every row, to go with clear_zbuffer
+====================*/
+void span_clear() {
+    if (!rows) rows = calloc(YRES, sizeof(struct span_row));
+    for (int y = 0; y < YRES; y++) rows[y].n = 0;
+    nspans = 0;
+}
+
+/*======== void span_triangles() ==========
+Inputs:   struct matrix * polygons
+          struct triangles * tris
+Inserts the spans of the set up triangles, in order
+====================*/
+void span_triangles(struct matrix * polygons, struct triangles * tris) {
+    for (int t = 0; t < tris -> count; t++)
+        span_convert(polygons, tris -> cols[t], tris -> colors[t]);
+}
+
+/*======== void span_resolve() ==========
+Inputs:   screen s
+          zbuffer zb
+Writes every span pixel nearer than zb into s and zb, then
+empties the rows
+====================*/
+void span_resolve(screen s, zbuffer zb) {
+    for (int y = 0; y < YRES; y++) {
+        int n = YRES - 1 - y;
+
+        for (int i = 0; i < rows[y].n; i++) {
+            struct span * sp = &rows[y].spans[i];
+
+            for (int x = sp -> x0; x < sp -> x1; x++) {
+                float z = span_depth(sp, x);
+
+                if (z > zb[n][x]) {
+                    zb[n][x] = z;
+                    s[n][x] = sp -> c;
+                }
+            }
+            span_stats.pixels += sp -> x1 - sp -> x0;
+        }
+    }
+    span_clear();
+}
+
+void span_print_stats() {
+    printf("Spans: inserted %ld, split %ld, peak %ld spans (%ld bytes), resolved %ld pixels\n",
+           span_stats.inserted, span_stats.split, span_stats.peak,
+           span_stats.peak * (long) sizeof(struct span), span_stats.pixels);
+}
@@ -0,0 +1,22 @@
+#ifndef SPAN_H
+#define SPAN_H
+
+#include "matrix.h"
+#include "ml6.h"
+#include "setup.h"
+
+struct span_stats {
+    long inserted;
+    long split;
+    long peak;
+    long pixels;
+};
+
+extern struct span_stats span_stats;
+
+void span_clear();
+void span_triangles(struct matrix * polygons, struct triangles * tris);
+void span_resolve(screen s, zbuffer zb);
+void span_print_stats();
+
+#endif
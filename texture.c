@@ -0,0 +1,547 @@
+/*====================== texture.c ========================
+Textured quads and the texture cache.
+
+The texture command maps an image onto the quad through its
+four corners: the first is the image's top left, then top
+right, bottom right and bottom left. The quad is drawn as
+two triangles, unlit, with a bilinear sample for every
+pixel that passes the depth test.
+
+Images are loaded the first time they're used, through
+convert unless they're already ppm, and stay loaded across
+frames. Each one gets a full chain of mip levels, box
+filtered, and a triangle samples the level whose texels are
+closest to its pixels in size, so minified images don't
+shimmer. Every level is stored in TEXTURE_TILE x TEXTURE_TILE
+tiles, so the 2x2 texels of a bilinear sample, and the
+neighboring samples along a span, are nearly always in the
+same few cache lines whichever way the quad is turned.
+
+Resident texels are held under the -c budget: loading an
+image past it evicts the least recently used ones first.
+An image bigger than the whole budget is still loaded, on
+its own.
+==================================================*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "ml6.h"
+#include "draw.h"
+#include "matrix.h"
+#include "config.h"
+#include "hiz.h"
+#include "gbuffer.h"
+#include "aa.h"
+#include "camera.h"
+#include "views.h"
+#include "texture.h"
+
+#define TILE_TEXELS (TEXTURE_TILE * TEXTURE_TILE)
+
+struct mip {
+    int w, h;
+    int tiles;              // tiles per row
+    unsigned char * data;   // rgb plus a pad byte per texel, in tiles
+};
+
+struct texture {
+    char * file;
+    int levels;             // 0 until loaded, and again once evicted
+    int missing;            // the file couldn't be read, don't try again
+    struct mip * mips;
+    long bytes;
+    long used;              // when it was last drawn, for LRU
+};
+
+struct texture_stats texture_stats;
+
+static struct texture * textures = NULL;
+static int ntextures = 0;
+static int textures_size = 0;
+static long uses = 0;
+
+static unsigned char * texel(struct mip * m, int x, int y) {
+    int tile = (y / TEXTURE_TILE) * m -> tiles + x / TEXTURE_TILE;
+
+    return m -> data + 4 * (tile * TILE_TEXELS + (y % TEXTURE_TILE) * TEXTURE_TILE
+                            + x % TEXTURE_TILE);
+}
+
+static void mip_alloc(struct mip * m, int w, int h) {
+    int th = (h + TEXTURE_TILE - 1) / TEXTURE_TILE;
+
+    m -> w = w;
+    m -> h = h;
+    m -> tiles = (w + TEXTURE_TILE - 1) / TEXTURE_TILE;
+    m -> data = calloc(m -> tiles * th * TILE_TEXELS, 4);
+}
+
+static int read_number(FILE * f) {
+    int c, n = 0;
+
+    // skip whitespace and comments
+    while ((c = getc(f)) != EOF) {
+        if (c == '#') while ((c = getc(f)) != EOF && c != '\n');
+        else if (c != ' ' && c != '\t' && c != '\n' && c != '\r') break;
+    }
+    if (c == EOF) return -1;
+
+    while (c >= '0' && c <= '9') {
+        n = n * 10 + c - '0';
+        c = getc(f);
+    }
+    return n;
+}
+
+/*======== int read_ppm() ==========
+Inputs:   FILE * f
+          struct mip * m
+Returns:  0 if f isn't a P3 or P6 ppm
+Reads the image into level 0
+====================*/
+static int read_ppm(FILE * f, struct mip * m) {
+    int binary;
+
+    if (getc(f) != 'P') return 0;
+    switch (getc(f)) {
+        case '3': binary = 0; break;
+        case '6': binary = 1; break;
+        default: return 0;
+    }
+
+    int w = read_number(f);
+    int h = read_number(f);
+    int max = read_number(f);
+    if (w <= 0 || h <= 0 || max <= 0 || max > 65535) return 0;
+
+    mip_alloc(m, w, h);
+    for (int y = 0; y < h; y++) {
+        for (int x = 0; x < w; x++) {
+            unsigned char * t = texel(m, x, y);
+
+            for (int i = 0; i < 3; i++) {
+                int v;
+
+                if (!binary) v = read_number(f);
+                else if (max < 256) v = getc(f);
+                else {
+                    v = getc(f) << 8;
+                    v |= getc(f);
+                }
+                if (v < 0) v = 0;
+                t[i] = v * 255 / max;
+            }
+        }
+    }
+    return 1;
+}
+
+/*======== void build_mips() ==========
+Inputs:   struct texture * tex (with level 0 read)
+Box filters each level into the next, down to 1x1
+====================*/
+static void build_mips(struct texture * tex) {
+    int levels = 1;
+
+    for (int w = tex -> mips[0].w, h = tex -> mips[0].h; w > 1 || h > 1; levels++) {
+        w = w > 1 ? w / 2 : 1;
+        h = h > 1 ? h / 2 : 1;
+    }
+    tex -> mips = realloc(tex -> mips, levels * sizeof(struct mip));
+    tex -> levels = levels;
+
+    for (int l = 1; l < levels; l++) {
+        struct mip * src = &tex -> mips[l - 1];
+        struct mip * dst = &tex -> mips[l];
+
+        mip_alloc(dst, src -> w > 1 ? src -> w / 2 : 1, src -> h > 1 ? src -> h / 2 : 1);
+        for (int y = 0; y < dst -> h; y++) {
+            for (int x = 0; x < dst -> w; x++) {
+                int x0 = 2 * x < src -> w ? 2 * x : src -> w - 1;
+                int y0 = 2 * y < src -> h ? 2 * y : src -> h - 1;
+                int x1 = x0 + 1 < src -> w ? x0 + 1 : x0;
+                int y1 = y0 + 1 < src -> h ? y0 + 1 : y0;
+                unsigned char * t = texel(dst, x, y);
+
+                for (int i = 0; i < 3; i++)
+                    t[i] = (texel(src, x0, y0)[i] + texel(src, x1, y0)[i]
+                            + texel(src, x0, y1)[i] + texel(src, x1, y1)[i] + 2) / 4;
+            }
+        }
+    }
+
+    tex -> bytes = 0;
+    for (int l = 0; l < levels; l++) {
+        struct mip * m = &tex -> mips[l];
+        tex -> bytes += 4L * m -> tiles * ((m -> h + TEXTURE_TILE - 1) / TEXTURE_TILE) * TILE_TEXELS;
+    }
+}
+
+static void unload(struct texture * tex) {
+    for (int l = 0; l < tex -> levels; l++) free(tex -> mips[l].data);
+    free(tex -> mips);
+    tex -> mips = NULL;
+    tex -> levels = 0;
+    texture_stats.resident -= tex -> bytes;
+    tex -> bytes = 0;
+}
+
+/*======== void evict() ==========
+Inputs:   long bytes
+          struct texture * keep
+Unloads the least recently used textures, other than keep,
+until bytes more would fit in the budget
+====================*/
+static void evict(long bytes, struct texture * keep) {
+    long budget = (long) opts.texture_budget << 20;
+
+    while (texture_stats.resident + bytes > budget) {
+        struct texture * lru = NULL;
+
+        for (int i = 0; i < ntextures; i++)
+            if (&textures[i] != keep && textures[i].levels
+                && (!lru || textures[i].used < lru -> used)) lru = &textures[i];
+
+        if (!lru) return;
+        unload(lru);
+        texture_stats.evictions++;
+    }
+}
+
+/*======== int load() ==========
+Inputs:   struct texture * tex
+Returns:  0 if the file couldn't be read
+====================*/
+static int load(struct texture * tex) {
+    char line[512];
+    int len = strlen(tex -> file);
+    int ppm = len > 4 && !strcmp(tex -> file + len - 4, ".ppm");
+    FILE * f;
+
+    if (ppm) f = fopen(tex -> file, "rb");
+    else {
+        snprintf(line, sizeof(line), "convert '%s' ppm:- 2>/dev/null", tex -> file);
+        f = popen(line, "r");
+    }
+    if (!f) return 0;
+
+    tex -> mips = calloc(1, sizeof(struct mip));
+    int ok = read_ppm(f, &tex -> mips[0]);
+
+    if (ppm) fclose(f);
+    else pclose(f);
+
+    if (!ok) {
+        free(tex -> mips[0].data);
+        free(tex -> mips);
+        tex -> mips = NULL;
+        return 0;
+    }
+
+    build_mips(tex);
+    evict(tex -> bytes, tex);
+    texture_stats.resident += tex -> bytes;
+    texture_stats.loads++;
+    return 1;
+}
+
+/*======== struct texture * texture_get() ==========
+Inputs:   char * file
+Returns:  The loaded texture for file, or NULL if it can't
+          be read
+====================*/
+static struct texture * texture_get(char * file) {
+    struct texture * tex = NULL;
+
+    for (int i = 0; i < ntextures; i++)
+        if (!strcmp(textures[i].file, file)) tex = &textures[i];
+
+    if (!tex) {
+        if (ntextures == textures_size) {
+            textures_size = textures_size ? textures_size * 2 : 16;
+            textures = realloc(textures, textures_size * sizeof(struct texture));
+        }
+        tex = &textures[ntextures++];
+        memset(tex, 0, sizeof(struct texture));
+        tex -> file = strdup(file);
+    }
+
+    tex -> used = ++uses;
+    if (tex -> missing) return NULL;
+    if (tex -> levels) {
+        texture_stats.hits++;
+        return tex;
+    }
+    if (!load(tex)) {
+        tex -> missing = 1;
+        printf("Can't read texture %s\n", file);
+        return NULL;
+    }
+    return tex;
+}
+
+/*======== color sample() ==========
+Inputs:   struct mip * m
+          double u, v (0 to 1 across the image)
+Returns:  The bilinear blend of the 4 texels around u, v,
+          clamped to the edges
+====================*/
+static color sample(struct mip * m, double u, double v) {
+    double x = u * m -> w - 0.5;
+    double y = v * m -> h - 0.5;
+    int x0 = floor(x);
+    int y0 = floor(y);
+    double fx = x - x0;
+    double fy = y - y0;
+    int x1 = x0 + 1;
+    int y1 = y0 + 1;
+
+    if (x0 < 0) x0 = 0;
+    if (y0 < 0) y0 = 0;
+    if (x1 < 0) x1 = 0;
+    if (y1 < 0) y1 = 0;
+    if (x0 > m -> w - 1) x0 = m -> w - 1;
+    if (y0 > m -> h - 1) y0 = m -> h - 1;
+    if (x1 > m -> w - 1) x1 = m -> w - 1;
+    if (y1 > m -> h - 1) y1 = m -> h - 1;
+
+    unsigned char * a = texel(m, x0, y0);
+    unsigned char * b = texel(m, x1, y0);
+    unsigned char * c = texel(m, x0, y1);
+    unsigned char * d = texel(m, x1, y1);
+    double k[3];
+
+    for (int i = 0; i < 3; i++)
+        k[i] = (a[i] * (1 - fx) + b[i] * fx) * (1 - fy) + (c[i] * (1 - fx) + d[i] * fx) * fy;
+
+    color p;
+    p.red = k[RED] + 0.5;
+    p.green = k[GREEN] + 0.5;
+    p.blue = k[BLUE] + 0.5;
+    p.alpha = MAX_COLOR;
+    return p;
+}
+
+/*======== void gradient() ==========
+Inputs:   double * x, y (the corners on the screen)
+          double * a (a value at each corner)
+          double area (twice the signed area)
+          double * dx, dy
+Sets dx and dy to how fast a changes across the screen
+====================*/
+static void gradient(double * x, double * y, double * a, double area, double * dx, double * dy) {
+    *dx = ((a[1] - a[0]) * (y[2] - y[0]) - (a[2] - a[0]) * (y[1] - y[0])) / area;
+    *dy = ((x[1] - x[0]) * (a[2] - a[0]) - (x[2] - x[0]) * (a[1] - a[0])) / area;
+}
+
+/*======== struct mip * mip_level() ==========
+Inputs:   struct texture * tex
+          double dudx, dvdx, dudy, dvdy
+Returns:  The level whose texels are nearest a pixel in size,
+          from how fast u and v change across the screen
+====================*/
+static struct mip * mip_level(struct texture * tex, double dudx, double dvdx,
+                              double dudy, double dvdy) {
+    double w = tex -> mips[0].w, h = tex -> mips[0].h;
+    double rho = fmax(sqrt(dudx * dudx * w * w + dvdx * dvdx * h * h),
+                      sqrt(dudy * dudy * w * w + dvdy * dvdy * h * h));
+    int level = rho > 1 ? floor(log2(rho) + 0.5) : 0;
+
+    if (level > tex -> levels - 1) level = tex -> levels - 1;
+    return &tex -> mips[level];
+}
+
+/*======== void texture_triangle() ==========
+Inputs:   struct texture * tex
+          double * x, y, z, u, v (per corner)
+          screen s
+          zbuffer zb
+Fills a triangle of the quad. Without a camera screen space
+is affine, so u and v are planes across it and one mip level
+does for the whole triangle. In perspective depth goes as
+one over distance, so u and v times depth are the planes,
+and the level is picked per pixel, since the near end of a
+triangle can be magnified while the far end is minified.
+====================*/
+static void texture_triangle(struct texture * tex, double * x, double * y, double * z,
+                             double * u, double * v, screen s, zbuffer zb) {
+    double area = (x[1] - x[0]) * (y[2] - y[0]) - (x[2] - x[0]) * (y[1] - y[0]);
+    if (area == 0) return;
+
+    int perspective = camera_active();
+    double uz[3], vz[3];
+    double dudx, dudy, dvdx, dvdy, dzdx, dzdy;
+    struct mip * m = NULL;
+
+    if (perspective) {
+        for (int i = 0; i < 3; i++) {
+            uz[i] = u[i] * z[i];
+            vz[i] = v[i] * z[i];
+        }
+        gradient(x, y, uz, area, &dudx, &dudy);
+        gradient(x, y, vz, area, &dvdx, &dvdy);
+        gradient(x, y, z, area, &dzdx, &dzdy);
+    }
+    else {
+        gradient(x, y, u, area, &dudx, &dudy);
+        gradient(x, y, v, area, &dvdx, &dvdy);
+        m = mip_level(tex, dudx, dvdx, dudy, dvdy);
+    }
+
+    int x0 = ceil(fmin(x[0], fmin(x[1], x[2])));
+    int x1 = floor(fmax(x[0], fmax(x[1], x[2])));
+    int y0 = ceil(fmin(y[0], fmin(y[1], y[2])));
+    int y1 = floor(fmax(y[0], fmax(y[1], y[2])));
+
+    if (x0 < 0) x0 = 0;
+    if (y0 < 0) y0 = 0;
+    if (x1 > XRES - 1) x1 = XRES - 1;
+    if (y1 > YRES - 1) y1 = YRES - 1;
+
+    for (int py = y0; py <= y1; py++) {
+        int row = YRES - 1 - py;
+
+        for (int px = x0; px <= x1; px++) {
+            double b0 = ((x[1] - px) * (y[2] - py) - (x[2] - px) * (y[1] - py)) / area;
+            double b1 = ((x[2] - px) * (y[0] - py) - (x[0] - px) * (y[2] - py)) / area;
+            double b2 = 1 - b0 - b1;
+
+            if (b0 < 0 || b1 < 0 || b2 < 0) continue;
+
+            double pz = b0 * z[0] + b1 * z[1] + b2 * z[2];
+            if ((float) pz <= zb[row][px]) continue;
+
+            double pu, pv;
+
+            if (perspective) {
+                pu = (b0 * uz[0] + b1 * uz[1] + b2 * uz[2]) / pz;
+                pv = (b0 * vz[0] + b1 * vz[1] + b2 * vz[2]) / pz;
+                m = mip_level(tex, (dudx - pu * dzdx) / pz, (dvdx - pv * dzdx) / pz,
+                              (dudy - pu * dzdy) / pz, (dvdy - pv * dzdy) / pz);
+            }
+            else {
+                pu = b0 * u[0] + b1 * u[1] + b2 * u[2];
+                pv = b0 * v[0] + b1 * v[1] + b2 * v[2];
+            }
+
+            color c = sample(m, pu, pv);
+
+            zb[row][px] = pz;
+            s[row][px] = opts.deferred ? gbuffer_flat(c) : c;
+        }
+    }
+}
+
+/*======== void texture_view() ==========
+Inputs:   struct texture * tex
+          struct matrix * corners (4 points, transformed)
+          screen s
+          zbuffer zb
+Maps tex onto the quad from the selected camera, into every
+sample plane with -a and as flat surfaces with -d. With a
+camera the quad is clipped and projected first.
+====================*/
+static void texture_view(struct texture * tex, struct matrix * corners, screen s, zbuffer zb) {
+    static double u[4] = {0, 1, 1, 0};
+    static double v[4] = {0, 0, 1, 1};
+    static int tri[2][3] = {{0, 1, 2}, {0, 2, 3}};
+    static struct matrix * points = NULL;
+    double uv[2][6 * (CAMERA_CLIP_MAX - 2)];
+
+    if (opts.deferred) s = gbuffer;
+
+    // the quad's triangles on the screen, with each corner's u and v
+    if (!points) points = new_matrix(4, 6 * (CAMERA_CLIP_MAX - 2));
+    points -> lastcol = 0;
+    for (int t = 0; t < 2; t++) {
+        double in[15], out[5 * CAMERA_CLIP_MAX];
+
+        for (int i = 0; i < 3; i++) {
+            int c = tri[t][i];
+
+            in[5 * i] = corners -> m[0][c];
+            in[5 * i + 1] = corners -> m[1][c];
+            in[5 * i + 2] = corners -> m[2][c];
+            in[5 * i + 3] = u[c];
+            in[5 * i + 4] = v[c];
+        }
+
+        int n = camera_clip(in, 3, 5, out);
+        for (int k = 1; k < n - 1; k++) {
+            int fan[3] = {0, k, k + 1};
+
+            for (int i = 0; i < 3; i++) {
+                double * p = out + 5 * fan[i];
+
+                uv[0][points -> lastcol] = p[3];
+                uv[1][points -> lastcol] = p[4];
+                add_point(points, p[0], p[1], p[2]);
+            }
+        }
+    }
+    if (points -> lastcol == 0) return;
+
+    for (int k = 0; k < aa_count(); k++) {
+        if (opts.aa > 1) {
+            aa_move(points, k - 1, k);
+            s = *aa_screen(k);
+            zb = *aa_zbuffer(k);
+        }
+
+        for (int col = 0; col < points -> lastcol; col += 3) {
+            double x[3], y[3], z[3];
+
+            for (int i = 0; i < 3; i++) {
+                x[i] = points -> m[0][col + i];
+                y[i] = points -> m[1][col + i];
+                z[i] = points -> m[2][col + i];
+            }
+            texture_triangle(tex, x, y, z, uv[0] + col, uv[1] + col, s, zb);
+        }
+    }
+    if (opts.aa > 1) aa_move(points, aa_count() - 1, -1);
+
+    if (opts.hiz) {
+        double ** m = points -> m;
+        double xmin = m[0][0], ymin = m[1][0], xmax = m[0][0], ymax = m[1][0];
+
+        for (int col = 1; col < points -> lastcol; col++) {
+            xmin = fmin(xmin, m[0][col]);
+            ymin = fmin(ymin, m[1][col]);
+            xmax = fmax(xmax, m[0][col]);
+            ymax = fmax(ymax, m[1][col]);
+        }
+        hiz_dirty(xmin, ymin, xmax, ymax);
+    }
+}
+
+/*======== void draw_texture() ==========
+Inputs:   struct matrix * corners (4 points, transformed)
+          char * file
+          screen s
+          zbuffer zb
+Maps the image in file onto the quad, from every camera
+with -v
+====================*/
+void draw_texture(struct matrix * corners, char * file, screen s, zbuffer zb) {
+    struct texture * tex = texture_get(file);
+
+    if (!tex) return;
+
+    for (int k = views_count() - 1; k > 0; k--) {
+        views_select(k, NULL);
+        texture_view(tex, corners, *views_screen(k), *views_zbuffer(k));
+    }
+    if (views_count() > 1) views_select(0, NULL);
+
+    texture_view(tex, corners, s, zb);
+}
+
+void texture_print_stats() {
+    printf("Textures: %ld loads, %ld hits, %ld evictions, %ld KB resident\n",
+           texture_stats.loads, texture_stats.hits, texture_stats.evictions,
+           texture_stats.resident >> 10);
+}
@@ -0,0 +1,24 @@
+#ifndef TEXTURE_H
+#define TEXTURE_H
+
+#include "matrix.h"
+#include "ml6.h"
+
+// Texels per side of a tile, a power of 2
+#define TEXTURE_TILE 8
+// Default texture memory budget, in megabytes
+#define TEXTURE_BUDGET 64
+
+struct texture_stats {
+    long loads;
+    long hits;
+    long evictions;
+    long resident;      // bytes of texels held right now
+};
+
+extern struct texture_stats texture_stats;
+
+void draw_texture(struct matrix * corners, char * file, screen s, zbuffer zb);
+void texture_print_stats();
+
+#endif
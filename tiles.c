@@ -0,0 +1,148 @@
+/*====================== tiles.c ========================
+Tile binned multithreaded triangle fill for draw_polygons.
+
+The triangles surviving setup_triangles, in submission order, are
+binned into every TILE_SIZE x TILE_SIZE tile their bounding
+box touches. Each tile is an independent task for the pool:
+it fills its triangles, in submission order, clipped to the
+tile. No two tasks touch the same pixel, and the clipped
+fills reproduce the unclipped depth values exactly, so the
+image matches the serial path pixel for pixel.
+==================================================*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "ml6.h"
+#include "draw.h"
+#include "matrix.h"
+#include "pool.h"
+#include "tiles.h"
+#include "setup.h"
+#include "shade.h"
+
+struct bin {
+    int * tris;
+    int count;
+    int size;
+};
+
+struct tile_job {
+    shade_fn fill;
+    struct matrix * polygons;
+    struct triangles * tris;
+    screen s;
+    zbuffer zb;
+};
+
+// TILES_Y rows of TILES_X bins, sized once the resolution is known
+static struct bin * bins = NULL;
+static int * busy = NULL;
+static int nbusy;
+
+/*======== void bin_add() ==========
+Inputs:   struct bin * b
+          int t
+Appends triangle t of the setup to the bin
+====================*/
+static void bin_add(struct bin * b, int t) {
+    if (b -> count == b -> size) {
+        b -> size = b -> size ? b -> size * 2 : 64;
+        b -> tris = realloc(b -> tris, b -> size * sizeof(int));
+    }
+    b -> tris[b -> count++] = t;
+}
+
+/*======== void bin_triangle() ==========
+Inputs:   double ** m
+          int col
+          int t
+Adds triangle t, starting at col, to each tile its bounding box overlaps.
+The box is padded by a pixel on every side since the fills
+step or evaluate in floating point and can round past a
+vertex.
+====================*/
+static void bin_triangle(double ** m, int col, int t) {
+    double xmin = fmin(m[0][col], fmin(m[0][col + 1], m[0][col + 2]));
+    double xmax = fmax(m[0][col], fmax(m[0][col + 1], m[0][col + 2]));
+    double ymin = fmin(m[1][col], fmin(m[1][col + 1], m[1][col + 2]));
+    double ymax = fmax(m[1][col], fmax(m[1][col + 1], m[1][col + 2]));
+
+    int x0 = floor(xmin) - 1;
+    int x1 = ceil(xmax) + 1;
+    int y0 = floor(ymin) - 1;
+    int y1 = ceil(ymax) + 1;
+
+    if (x0 < 0) x0 = 0;
+    if (y0 < 0) y0 = 0;
+    if (x1 > XRES - 1) x1 = XRES - 1;
+    if (y1 > YRES - 1) y1 = YRES - 1;
+    if (x0 > x1 || y0 > y1) return;
+
+    for (int ty = y0 / TILE_SIZE; ty <= y1 / TILE_SIZE; ty++) {
+        for (int tx = x0 / TILE_SIZE; tx <= x1 / TILE_SIZE; tx++) {
+            struct bin * b = &bins[ty * TILES_X + tx];
+
+            if (b -> count == 0) busy[nbusy++] = ty * TILES_X + tx;
+            bin_add(b, t);
+        }
+    }
+}
+
+/*======== void draw_tile() ==========
+Inputs:   int i
+          void * arg
+Pool task: rasterizes everything binned into busy tile i
+====================*/
+static void draw_tile(int i, void * arg) {
+    struct tile_job * job = arg;
+    int tx = busy[i] % TILES_X;
+    int ty = busy[i] / TILES_X;
+    struct bin * b = &bins[busy[i]];
+    struct rect clip;
+
+    clip.x0 = tx * TILE_SIZE;
+    clip.y0 = ty * TILE_SIZE;
+    clip.x1 = clip.x0 + TILE_SIZE < XRES ? clip.x0 + TILE_SIZE : XRES;
+    clip.y1 = clip.y0 + TILE_SIZE < YRES ? clip.y0 + TILE_SIZE : YRES;
+
+    for (int i = 0; i < b -> count; i++) {
+        int t = b -> tris[i];
+
+        job -> fill(job -> polygons, job -> tris, t, job -> s, job -> zb, &clip);
+    }
+    b -> count = 0;
+}
+
+/*======== void draw_triangles_tiled() ==========
+  Inputs:   struct matrix * polygons
+            struct triangles * tris
+            shade_fn fill
+            screen s
+            zbuffer zb
+  Returns:
+  Bins the triangles set up from polygons, then rasterizes
+  the tiles in parallel on the worker pool
+  ====================*/
+void draw_triangles_tiled( struct matrix * polygons, struct triangles * tris,
+                           shade_fn fill, screen s, zbuffer zb) {
+    double ** m = polygons -> m;
+    struct tile_job job;
+
+    if (!bins) {
+        bins = calloc(TILES_X * TILES_Y, sizeof(struct bin));
+        busy = malloc(TILES_X * TILES_Y * sizeof(int));
+    }
+
+    nbusy = 0;
+    for (int t = 0; t < tris -> count; t++)
+        bin_triangle(m, tris -> cols[t], t);
+
+    job.fill = fill;
+    job.polygons = polygons;
+    job.tris = tris;
+    job.s = s;
+    job.zb = zb;
+    pool_run(nbusy, draw_tile, &job);
+}
@@ -0,0 +1,17 @@
+#ifndef TILES_H
+#define TILES_H
+
+#include "matrix.h"
+#include "ml6.h"
+#include "symtab.h"
+#include "setup.h"
+#include "shade.h"
+
+#define TILE_SIZE 32
+#define TILES_X ((XRES + TILE_SIZE - 1) / TILE_SIZE)
+#define TILES_Y ((YRES + TILE_SIZE - 1) / TILE_SIZE)
+
+void draw_triangles_tiled( struct matrix * polygons, struct triangles * tris,
+                           shade_fn fill, screen s, zbuffer zb);
+
+#endif
@@ -0,0 +1,130 @@
+/*====================== views.c ========================
+Several views of one script, with -v.
+
+With -v every camera command is a view of its own. The last
+camera is view 0: it's drawn into the script's screen and
+saved under the names the script gives, just as without -v.
+Each earlier camera, in order, is view 1, 2 and so on, with
+a screen and zbuffer of its own, saved next to view 0's with
+view1_, view2_ and so on in front of the file name.
+
+Knobs, the stack and tessellation all run once per shape.
+draw_polygons, draw_lines, draw_texture and ray_flush then
+project and draw what they're given once per view, each
+pass using the raster threads as usual. They go through the
+views last to first, so view 0 is always the one selected
+between draws, and culling, which passes a shape seen by any
+view, is the only other place that looks at the rest.
+==================================================*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ml6.h"
+#include "display.h"
+#include "camera.h"
+#include "views.h"
+
+static screen * screens = NULL;
+static zbuffer * depths = NULL;
+static int nviews = 1;
+
+/*======== void views_init() ==========
+Makes a view of every camera camera_add kept, and selects
+view 0
+====================*/
+void views_init() {
+    if (camera_count() < 2) return;
+
+    nviews = camera_count();
+    screens = malloc((nviews - 1) * sizeof(screen));
+    depths = malloc((nviews - 1) * sizeof(zbuffer));
+    for (int k = 0; k < nviews - 1; k++) {
+        screens[k] = new_screen();
+        depths[k] = new_zbuffer();
+    }
+    views_select(0, NULL);
+}
+
+// Number of views drawn, 1 without -v
+int views_count() {
+    return nviews;
+}
+
+// view 0 draws into the script's own screen and zbuffer
+screen * views_screen(int k) {
+    return &screens[k - 1];
+}
+
+zbuffer * views_zbuffer(int k) {
+    return &depths[k - 1];
+}
+
+/*======== void views_select() ==========
+Inputs:   int k
+          double * view (or NULL)
+Draws from view k's camera from now on, and points view at
+its eye
+====================*/
+void views_select(int k, double * view) {
+    camera_select(k ? k - 1 : nviews - 1);
+
+    if (view) {
+        view[0] = 0;
+        view[1] = 0;
+        view[2] = 1;
+        camera_view(view);
+    }
+}
+
+/*======== void views_clear() ==========
+Clears every view but view 0, to go with clear_screen and
+clear_zbuffer
+====================*/
+void views_clear() {
+    for (int k = 1; k < nviews; k++) {
+        clear_screen(screens[k - 1]);
+        clear_zbuffer(depths[k - 1]);
+    }
+}
+
+/*======== void view_name() ==========
+Inputs:   int k
+          char * name
+          char * out
+Sets out to name with viewk_ in front of its file name
+====================*/
+static void view_name(int k, char * name, char * out) {
+    char * file = strrchr(name, '/');
+    int dir = file ? file - name + 1 : 0;
+
+    sprintf(out, "%.*sview%d_%s", dir, name, k, name + dir);
+}
+
+/*======== void views_save() ==========
+Inputs:   char * name
+Saves every view but view 0, which the caller saves as name
+====================*/
+void views_save(char * name) {
+    char file[256];
+
+    for (int k = 1; k < nviews; k++) {
+        view_name(k, name, file);
+        save_extension(screens[k - 1], file);
+    }
+}
+
+/*======== void views_animate() ==========
+Inputs:   char * name
+Makes the animation of every view but view 0 out of the
+frames views_save wrote, before the caller makes view 0's
+====================*/
+void views_animate(char * name) {
+    char basename[128];
+
+    for (int k = 1; k < nviews; k++) {
+        snprintf(basename, sizeof(basename) - 4, "view%d_%s", k, name);
+        make_animation(basename);
+    }
+}
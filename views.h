@@ -0,0 +1,15 @@
+#ifndef VIEWS_H
+#define VIEWS_H
+
+#include "ml6.h"
+
+void views_init();
+int views_count();
+screen * views_screen(int k);
+zbuffer * views_zbuffer(int k);
+void views_select(int k, double * view);
+void views_clear();
+void views_save(char * name);
+void views_animate(char * name);
+
+#endif
@@ -0,0 +1,245 @@
+/*====================== wire.c ========================
+Wireframe rendering for shading wireframe.
+
+Triangles of a mesh share their edges, so drawing three
+lines per triangle draws nearly every edge twice. Each mesh's
+edges go through a set keyed by their endpoints, and one
+already in it isn't drawn again. The set is open addressed
+with linear probing and sized to at least twice the edges a
+mesh can have, so every shared edge is found and drawn once.
+It's emptied by bumping a stamp rather than clearing it.
+Shared edges come from the same points, so their coordinates
+match exactly. Edges within a single pixel skip the set,
+since plotting that pixel twice is cheaper than the lookup.
+
+Each edge is clipped to the screen before stepping, so
+nothing is spent on pixels plot would throw away, and the
+pixels inside are written straight to the screen and
+zbuffer without the per pixel checks in plot.
+==================================================*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "ml6.h"
+#include "matrix.h"
+#include "wire.h"
+
+// Slots in the smallest edge set, a power of 2
+#define WIRE_SET 4096
+
+struct edge_key {
+    double p[6];
+};
+
+struct wire_stats wire_stats;
+
+static struct edge_key * edges = NULL;
+static unsigned * stamps = NULL;
+static int set_size = 0;
+static unsigned stamp = 0;
+
+static unsigned long hash_edge(struct edge_key * k) {
+    unsigned long h = 1469598103934665603UL;
+
+    for (int i = 0; i < 6; i++) {
+        unsigned long bits;
+        memcpy(&bits, &k -> p[i], sizeof(bits));
+        h = (h ^ bits) * 1099511628211UL;
+        h ^= h >> 29;
+    }
+    return h;
+}
+
+/*======== int seen_edge() ==========
+Inputs:   struct edge_key * k
+Returns:  1 if k was drawn for this mesh, otherwise adds it
+====================*/
+static int seen_edge(struct edge_key * k) {
+    int i = hash_edge(k) & (set_size - 1);
+
+    // never more than half full, so an empty slot is close
+    while (stamps[i] == stamp) {
+        if (!memcmp(&edges[i], k, sizeof(struct edge_key))) return 1;
+        i = (i + 1) & (set_size - 1);
+    }
+
+    stamps[i] = stamp;
+    edges[i] = *k;
+    return 0;
+}
+
+/*======== int clip_wire() ==========
+Inputs:   double * p0, double * p1 (x, y, z)
+Returns:  0 if the segment is entirely off screen
+Clips the segment to the screen in place (Liang-Barsky),
+interpolating z along with it
+====================*/
+static int clip_wire(double * p0, double * p1) {
+    double lo[2] = {0, 0};
+    double hi[2] = {XRES - 1, YRES - 1};
+    double t0 = 0, t1 = 1;
+
+    for (int a = 0; a < 2; a++) {
+        double d = p1[a] - p0[a];
+        double tlo, thi;
+
+        if (d == 0) {
+            if (p0[a] < lo[a] || p0[a] > hi[a]) return 0;
+            continue;
+        }
+        tlo = (lo[a] - p0[a]) / d;
+        thi = (hi[a] - p0[a]) / d;
+        if (tlo > thi) {
+            double t = tlo;
+            tlo = thi;
+            thi = t;
+        }
+        if (tlo > t0) t0 = tlo;
+        if (thi < t1) t1 = thi;
+        if (t0 > t1) return 0;
+    }
+
+    if (t0 > 0 || t1 < 1) wire_stats.clipped++;
+
+    double q0[3], q1[3];
+    for (int i = 0; i < 3; i++) {
+        q0[i] = p0[i] + t0 * (p1[i] - p0[i]);
+        q1[i] = p0[i] + t1 * (p1[i] - p0[i]);
+    }
+    memcpy(p0, q0, sizeof(q0));
+    memcpy(p1, q1, sizeof(q1));
+    return 1;
+}
+
+/*======== void draw_wire() ==========
+Inputs:   double x0, y0, z0
+          double x1, y1, z1
+          screen s
+          zbuffer zb
+          color c
+Returns:
+Draws the line between the points, clipped to the screen,
+with an integer Bresenham loop along the major axis
+====================*/
+void draw_wire( double x0, double y0, double z0,
+                double x1, double y1, double z1,
+                screen s, zbuffer zb, color c) {
+    double p0[3] = {x0, y0, z0};
+    double p1[3] = {x1, y1, z1};
+
+    if (!clip_wire(p0, p1)) return;
+
+    int xa = lround(p0[0]), ya = lround(p0[1]);
+    int xb = lround(p1[0]), yb = lround(p1[1]);
+    int dx = abs(xb - xa), dy = abs(yb - ya);
+    int sx = xb > xa ? 1 : -1;
+    int sy = yb > ya ? 1 : -1;
+    int steps = dx > dy ? dx : dy;
+    double z = p0[2];
+    double mz = steps ? (p1[2] - p0[2]) / steps : 0;
+
+    // raster y grows up, the screen's newy grows down
+    int x = xa, newy = YRES - 1 - ya;
+    int sn = -sy;
+
+    if (dx >= dy) {
+        int d = 2 * dy - dx;
+
+        for (int i = 0; i <= steps; i++) {
+            if ((float) z > zb[newy][x]) {
+                zb[newy][x] = z;
+                s[newy][x] = c;
+            }
+            if (d > 0) {
+                newy += sn;
+                d -= 2 * dx;
+            }
+            d += 2 * dy;
+            x += sx;
+            z += mz;
+        }
+    }
+    else {
+        int d = 2 * dx - dy;
+
+        for (int i = 0; i <= steps; i++) {
+            if ((float) z > zb[newy][x]) {
+                zb[newy][x] = z;
+                s[newy][x] = c;
+            }
+            if (d > 0) {
+                x += sx;
+                d -= 2 * dy;
+            }
+            d += 2 * dx;
+            newy += sn;
+            z += mz;
+        }
+    }
+}
+
+/*======== void draw_wireframe() ==========
+Inputs:   struct matrix * polygons
+          screen s
+          zbuffer zb
+          color c
+Returns:
+Draws the edges of the triangles in polygons, shared ones
+once
+====================*/
+void draw_wireframe(struct matrix * polygons, screen s, zbuffer zb, color c) {
+    double ** m = polygons -> m;
+    int lastcol = polygons -> lastcol;
+
+    // a mesh has at most one distinct edge per column
+    if (set_size < 2 * lastcol) {
+        while (set_size < 2 * lastcol) set_size = set_size ? set_size * 2 : WIRE_SET;
+        free(edges);
+        free(stamps);
+        edges = malloc(set_size * sizeof(struct edge_key));
+        stamps = calloc(set_size, sizeof(unsigned));
+        stamp = 0;
+    }
+
+    // forget the last object's edges
+    if (++stamp == 0) {
+        memset(stamps, 0, set_size * sizeof(unsigned));
+        stamp = 1;
+    }
+
+    for (int col = 0; col < lastcol - 2; col += 3) {
+        for (int e = 0; e < 3; e++) {
+            int a = col + e;
+            int b = col + (e + 1) % 3;
+            struct edge_key k;
+
+            wire_stats.edges++;
+
+            if (lround(m[0][a]) != lround(m[0][b]) || lround(m[1][a]) != lround(m[1][b])) {
+                // same key whichever way round the triangle has it
+                if (m[0][b] < m[0][a] || (m[0][b] == m[0][a] &&
+                    (m[1][b] < m[1][a] || (m[1][b] == m[1][a] && m[2][b] < m[2][a])))) {
+                    int t = a;
+                    a = b;
+                    b = t;
+                }
+                for (int i = 0; i < 3; i++) {
+                    k.p[i] = m[i][a];
+                    k.p[i + 3] = m[i][b];
+                }
+                if (seen_edge(&k)) continue;
+            }
+
+            wire_stats.drawn++;
+            draw_wire(m[0][a], m[1][a], m[2][a], m[0][b], m[1][b], m[2][b], s, zb, c);
+        }
+    }
+}
+
+void wire_print_stats() {
+    printf("Wireframe: drew %ld of %ld edges, %ld clipped\n",
+           wire_stats.drawn, wire_stats.edges, wire_stats.clipped);
+}
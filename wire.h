@@ -0,0 +1,21 @@
+#ifndef WIRE_H
+#define WIRE_H
+
+#include "matrix.h"
+#include "ml6.h"
+
+struct wire_stats {
+    long edges;
+    long drawn;
+    long clipped;
+};
+
+extern struct wire_stats wire_stats;
+
+void draw_wireframe(struct matrix * polygons, screen s, zbuffer zb, color c);
+void draw_wire( double x0, double y0, double z0,
+                double x1, double y1, double z1,
+                screen s, zbuffer zb, color c);
+void wire_print_stats();
+
+#endif